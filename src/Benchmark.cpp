@@ -0,0 +1,1100 @@
+#include "Benchmark.h"
+#include "fe/GaborFilterBank.h"
+#include "KMeans.h"
+#include "Superpixels.h"
+#include "ComponentLabeler.h"
+#include "Textonator.h"
+
+#include <windows.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// The response buffer of the Gabor bank benchmark on the images too large to keep whole
+#define BENCH_GABOR_STRIP_BYTES		(128 * 1024 * 1024)
+
+// The rows of the k-means thread scaling mixture: 2048x1024 pixels are 120 MB
+// of features, a 4096^2 image (1 GB) does not fit a 32 bit process
+#define BENCH_KMEANS_ROWS			(2048 * 1024)
+
+bool Benchmark::run(const char * strName, IplImage * pInputImage, int nClusters)
+{
+	if (!strcmp(strName, "gabor"))
+		gabor();
+	else if (!strcmp(strName, "threads"))
+		threads(pInputImage);
+	else if (!strcmp(strName, "compact"))
+		compact(pInputImage);
+	else if (!strcmp(strName, "kmeans"))
+		kmeans(pInputImage, nClusters);
+	else if (!strcmp(strName, "kmeansthreads"))
+		kmeansThreads(pInputImage, nClusters);
+	else if (!strcmp(strName, "superpixels"))
+		superpixels(pInputImage, nClusters);
+	else if (!strcmp(strName, "floodfill"))
+		floodFill();
+	else if (!strcmp(strName, "labeling"))
+		componentLabeling(nClusters);
+	else if (!strcmp(strName, "rejection"))
+		textonRejection();
+	else if (!strcmp(strName, "edges"))
+		textonEdges(pInputImage, nClusters);
+	else if (!strcmp(strName, "remaining"))
+		remainingData();
+	else if (!strcmp(strName, "stray"))
+		strayPixels();
+	else
+		return false;
+
+	return true;
+}
+
+void Benchmark::gabor()
+{
+	printf("<<< Gabor bank: spatial vs. FFT vs. octave vs. separable >>>\n");
+
+	// Made in separable mode, so the kernels are decomposed (and reported) before the timings
+	CGaborFilterBank bank(GABOR_MODE_SEPARABLE);
+	CvRNG rng = cvRNG(0x12345678);
+	int nModes[4] = { GABOR_MODE_SPATIAL, GABOR_MODE_FFT, GABOR_MODE_OCTAVE, GABOR_MODE_SEPARABLE };
+	const char * strModes[4] = { "spatial", "fft", "octave", "separable" };
+
+	// The halo of the strips is the largest one of the modes
+	int nMaxHalo = 0;
+	for (int m = 0; m < 4; m++) {
+		bank.SetMode(nModes[m]);
+		nMaxHalo = MAX(nMaxHalo, bank.GetHalo());
+	}
+
+	for (int nSize = 256; nSize <= 4096; nSize *= 2) {
+		IplImage * pGrayImg = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_32F, 1);
+		cvRandArr(&rng, pGrayImg, CV_RAND_UNI, cvScalarAll(0), cvScalarAll(255));
+
+		printf("%4dx%-4d", nSize, nSize);
+
+		// Keep both whole responses only while they are small enough to compare, 
+		// the larger images are filtered in row strips (as the tiled extraction does)
+		// into a bounded buffer
+		CvMat * pSpatialMat = NULL;
+		CvMat * pModeMat = NULL;
+		CvMat * pStripMat = NULL;
+		int nStripRows = nSize;
+		if (nSize <= 1024) {
+			pSpatialMat = cvCreateMat(nSize * nSize, GABOR_SIZE, CV_32F);
+			pModeMat = cvCreateMat(nSize * nSize, GABOR_SIZE, CV_32F);
+		}
+		else {
+			int nMaxRows = BENCH_GABOR_STRIP_BYTES / (nSize * GABOR_SIZE * (int)sizeof(float));
+			nStripRows = MAX(nMaxRows - 2*nMaxHalo, 16);
+			pStripMat = cvCreateMat((nStripRows + 2*nMaxHalo) * nSize, GABOR_SIZE, CV_32F);
+			printf(" (strips of %d rows)", nStripRows);
+		}
+
+		DWORD spatialTime = 0;
+		for (int m = 0; m < 4; m++) {
+			bank.SetMode(nModes[m]);
+			DWORD time1 = GetTickCount();
+			if (pStripMat != NULL)
+				gaborStrips(bank, pGrayImg, pStripMat, nStripRows);
+			else
+				bank.Apply(pGrayImg, m == 0 ? pSpatialMat : pModeMat);
+			DWORD time2 = GetTickCount();
+
+			if (m == 0) {
+				spatialTime = time2 - time1;
+				printf(" %s=%ld ms", strModes[m], spatialTime);
+				continue;
+			}
+
+			printf(", %s=%ld ms (x%.2f", strModes[m], time2 - time1,
+				(double)spatialTime / MAX(time2 - time1, 1));
+			// Error relative to the full 2D spatial response
+			if (pModeMat != NULL) {
+				printf(", relative error: max=%g, L2=%g", 
+					cvNorm(pSpatialMat, pModeMat, CV_C) / cvNorm(pSpatialMat, 0, CV_C),
+					cvNorm(pSpatialMat, pModeMat, CV_L2) / cvNorm(pSpatialMat, 0, CV_L2));
+
+				// and of each frequency band (the pyramid level of the octave mode)
+				printf(", L2 per level:");
+				for (int nLevel = 0; nLevel < GABOR_FREQUENCIES_NUM; nLevel++) {
+					CvMat spatialCols, modeCols;
+					cvGetCols(pSpatialMat, &spatialCols, nLevel*GABOR_ORIENTATIONS_NUM, (nLevel + 1)*GABOR_ORIENTATIONS_NUM);
+					cvGetCols(pModeMat, &modeCols, nLevel*GABOR_ORIENTATIONS_NUM, (nLevel + 1)*GABOR_ORIENTATIONS_NUM);
+					printf(" %g", cvNorm(&spatialCols, &modeCols, CV_L2) / cvNorm(&spatialCols, 0, CV_L2));
+				}
+			}
+			printf(")");
+		}
+		printf("\n");
+
+		if (pStripMat != NULL)
+			cvReleaseMat(&pStripMat);
+		else {
+			cvReleaseMat(&pModeMat);
+			cvReleaseMat(&pSpatialMat);
+		}
+		cvReleaseImage(&pGrayImg);
+	}
+}
+
+void Benchmark::gaborStrips(CGaborFilterBank& bank, IplImage * pGrayImg, CvMat * pStripMat, int nStripRows)
+{
+	int nWidth = pGrayImg->width;
+	int nHeight = pGrayImg->height;
+	int nHalo = bank.GetHalo();
+
+	for (int y = 0; y < nHeight; y += nStripRows) {
+		// The strip and its halo, the rows of the response are overwritten by the next strip
+		int nTop = MAX(y - nHalo, 0);
+		int nBottom = MIN(y + nStripRows + nHalo, nHeight);
+		IplImage * pStripImg = cvCreateImage(cvSize(nWidth, nBottom - nTop), IPL_DEPTH_32F, 1);
+		cvSetImageROI(pGrayImg, cvRect(0, nTop, nWidth, nBottom - nTop));
+		cvCopy(pGrayImg, pStripImg);
+		cvResetImageROI(pGrayImg);
+
+		CvMat stripRows;
+		cvGetRows(pStripMat, &stripRows, 0, (nBottom - nTop) * nWidth);
+		bank.Apply(pStripImg, &stripRows);
+		cvReleaseImage(&pStripImg);
+	}
+}
+
+void Benchmark::threads(IplImage * pInputImage)
+{
+	printf("<<< Gabor bank: thread scaling >>>\n");
+
+#ifndef _OPENMP
+	printf("Built without OpenMP, nothing to compare.\n");
+#else
+	IplImage * pGrayImg;
+	if (pInputImage != NULL) {
+		IplImage * pFloatImg = cvCreateImage(cvGetSize(pInputImage), IPL_DEPTH_32F, 3);
+		cvConvertScale(pInputImage, pFloatImg, 1.0, 0);
+		pGrayImg = cvCreateImage(cvGetSize(pInputImage), IPL_DEPTH_32F, 1);
+		cvCvtColor(pFloatImg, pGrayImg, CV_BGR2GRAY);
+		cvReleaseImage(&pFloatImg);
+	}
+	else {
+		CvRNG rng = cvRNG(0x12345678);
+		pGrayImg = cvCreateImage(cvSize(1024, 1024), IPL_DEPTH_32F, 1);
+		cvRandArr(&rng, pGrayImg, CV_RAND_UNI, cvScalarAll(0), cvScalarAll(255));
+	}
+
+	CvMat * pGaborMat = cvCreateMat(pGrayImg->width * pGrayImg->height, GABOR_SIZE, CV_32F);
+	CGaborFilterBank bank;
+	int nMaxThreads = omp_get_num_procs();
+	int nModes[2] = { GABOR_MODE_SPATIAL, GABOR_MODE_FFT };
+	const char * strModes[2] = { "spatial", "fft" };
+
+	printf("%dx%d image, %d processors\n", pGrayImg->width, pGrayImg->height, nMaxThreads);
+	for (int m = 0; m < 2; m++) {
+		bank.SetMode(nModes[m]);
+		DWORD baseTime = 0;
+
+		for (int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2) {
+			omp_set_num_threads(nThreads);
+
+			DWORD time1 = GetTickCount();
+			bank.Apply(pGrayImg, pGaborMat);
+			DWORD time2 = GetTickCount();
+
+			if (nThreads == 1)
+				baseTime = time2 - time1;
+
+			printf("%-7s threads=%2d time=%7ld ms speedup=%.2f\n", 
+				strModes[m], nThreads, time2 - time1, 
+				(double)baseTime / MAX(time2 - time1, 1));
+		}
+	}
+	omp_set_num_threads(nMaxThreads);
+
+	cvReleaseMat(&pGaborMat);
+	cvReleaseImage(&pGrayImg);
+#endif
+}
+
+CvMat * Benchmark::createChannels(IplImage * pInputImage, int nRows, int nClusters, CvRNG * pRng)
+{
+	int nCols = COLOR_CHANNEL_NUM + TEXTURE_CHANNEL_NUM;
+	CvMat * pChannels;
+
+	if (pInputImage != NULL) {
+		CFeatureExtraction extractor(pInputImage);
+		extractor.run();
+		pChannels = cvCreateMat(pInputImage->width * pInputImage->height, nCols, CV_32F);
+		cvConvertScale(extractor.GetPrincipalChannels(), pChannels, 
+			1 / cvNorm(extractor.GetPrincipalChannels(), 0, CV_C, 0));
+		return pChannels;
+	}
+
+	// Gaussian blobs around random centers in [-1,1]^nCols
+	pChannels = cvCreateMat(nRows, nCols, CV_32F);
+	CvMat * pCenters = cvCreateMat(nClusters, nCols, CV_32F);
+	cvRandArr(pRng, pCenters, CV_RAND_UNI, cvScalarAll(-1), cvScalarAll(1));
+	cvRandArr(pRng, pChannels, CV_RAND_NORMAL, cvScalarAll(0), cvScalarAll(0.2));
+
+	for (int i = 0; i < nRows; i++) {
+		float * pRow = pChannels->data.fl + i * nCols;
+		const float * pCenter = pCenters->data.fl + (cvRandInt(pRng) % nClusters) * nCols;
+		for (int c = 0; c < nCols; c++)
+			pRow[c] += pCenter[c];
+	}
+
+	cvReleaseMat(&pCenters);
+	return pChannels;
+}
+
+IplImage * Benchmark::createImage(IplImage * pInputImage, int nSize, int nClusters)
+{
+	if (pInputImage != NULL)
+		return cvCloneImage(pInputImage);
+
+	// 64x64 blocks of noise around one of nClusters colors
+	CvRNG rng = cvRNG(0x12345678);
+	IplImage * pImg = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_8U, 3);
+	CvScalar * pColors = new CvScalar[nClusters];
+	for (int k = 0; k < nClusters; k++)
+		pColors[k] = cvScalar(cvRandInt(&rng) % 256, cvRandInt(&rng) % 256, cvRandInt(&rng) % 256);
+
+	for (int y = 0; y < pImg->height; y += 64) {
+		for (int x = 0; x < pImg->width; x += 64) {
+			cvSetImageROI(pImg, cvRect(x, y, 64, 64));
+			cvRandArr(&rng, pImg, CV_RAND_NORMAL, pColors[cvRandInt(&rng) % nClusters], cvScalarAll(20));
+		}
+	}
+	cvResetImageROI(pImg);
+	delete [] pColors;
+	return pImg;
+}
+
+double Benchmark::labelAgreement(const CvMat * pLabels1, const CvMat * pLabels2, int nClusters)
+{
+	int nRows = pLabels1->rows;
+	int * pOverlap = new int[nClusters * nClusters];
+	bool * pUsed1 = new bool[nClusters];
+	bool * pUsed2 = new bool[nClusters];
+	int i, j, k;
+
+	memset(pOverlap, 0, nClusters * nClusters * sizeof(int));
+	memset(pUsed1, 0, nClusters * sizeof(bool));
+	memset(pUsed2, 0, nClusters * sizeof(bool));
+
+	for (i = 0; i < nRows; i++)
+		pOverlap[pLabels1->data.i[i] * nClusters + pLabels2->data.i[i]]++;
+
+	// Match the pair of clusters with the largest overlap, nClusters times
+	int nAgree = 0;
+	for (k = 0; k < nClusters; k++) {
+		int nBest = -1, nBest1 = 0, nBest2 = 0;
+		for (i = 0; i < nClusters; i++) {
+			for (j = 0; j < nClusters; j++) {
+				if (!pUsed1[i] && !pUsed2[j] && pOverlap[i * nClusters + j] > nBest) {
+					nBest = pOverlap[i * nClusters + j];
+					nBest1 = i;
+					nBest2 = j;
+				}
+			}
+		}
+		pUsed1[nBest1] = pUsed2[nBest2] = true;
+		nAgree += nBest;
+	}
+
+	delete [] pUsed2;
+	delete [] pUsed1;
+	delete [] pOverlap;
+
+	return (double)nAgree / nRows;
+}
+
+void Benchmark::compact(IplImage * pInputImage)
+{
+	printf("<<< k-means: float vs. half vs. 8 bit channels >>>\n");
+
+	int nClusters = 6;
+	CvRNG rng = cvRNG(0x12345678);
+	CvMat * pChannels = createChannels(pInputImage, 1024 * 1024, nClusters, &rng);
+	CvTermCriteria criteria = cvTermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.001);
+	int nRows = pChannels->rows;
+
+	CvMat * pFloatLabels = cvCreateMat(nRows, 1, CV_32SC1);
+	CvMat * pLabels = cvCreateMat(nRows, 1, CV_32SC1);
+
+	printf("%d rows x %d channels, %d clusters\n", nRows, pChannels->cols, nClusters);
+
+	// The float path of the pipeline
+	DWORD time1 = GetTickCount();
+	cvKMeans2(pChannels, nClusters, pLabels, criteria);
+	DWORD time2 = GetTickCount();
+	printf("cvKMeans2: time=%ld ms\n", time2 - time1);
+
+	// The same initial centers for all the storage modes
+	for (int nStorage = FEATURE_STORAGE_FLOAT; nStorage <= FEATURE_STORAGE_BYTE; nStorage++) {
+		CvRNG initRng = cvRNG(0x87654321);
+		CvMat * pModeLabels = (nStorage == FEATURE_STORAGE_FLOAT) ? pFloatLabels : pLabels;
+		const char * strMode;
+		int nIter, nBytes;
+
+		time1 = GetTickCount();
+		if (nStorage == FEATURE_STORAGE_FLOAT) {
+			CFloatFeatures features(pChannels);
+			CKMeans<CFloatFeatures> kmeans(features, nClusters);
+			nIter = kmeans.Run(pModeLabels, criteria, &initRng);
+			nBytes = features.GetBytes();
+			strMode = "float";
+		}
+		else if (nStorage == FEATURE_STORAGE_HALF) {
+			CHalfFeatures features(pChannels);
+			CKMeans<CHalfFeatures> kmeans(features, nClusters);
+			nIter = kmeans.Run(pModeLabels, criteria, &initRng);
+			nBytes = features.GetBytes();
+			strMode = "half";
+		}
+		else {
+			CByteFeatures features(pChannels);
+			CKMeans<CByteFeatures> kmeans(features, nClusters);
+			nIter = kmeans.Run(pModeLabels, criteria, &initRng);
+			nBytes = features.GetBytes();
+			strMode = "byte";
+		}
+		time2 = GetTickCount();
+
+		printf("%-5s %6.1f MB, iterations=%3d, time=%6ld ms, %7.1f Mrows/s", 
+			strMode, nBytes / (1024.0 * 1024.0), nIter, time2 - time1,
+			(double)nRows * (nIter + 1) / 1000.0 / MAX(time2 - time1, 1));
+		if (nStorage != FEATURE_STORAGE_FLOAT)
+			printf(", label agreement with float=%.4f", labelAgreement(pFloatLabels, pModeLabels, nClusters));
+		printf("\n");
+	}
+
+	cvReleaseMat(&pLabels);
+	cvReleaseMat(&pFloatLabels);
+	cvReleaseMat(&pChannels);
+}
+
+void Benchmark::kmeans(IplImage * pInputImage, int nClusters)
+{
+	printf("<<< k-means: cvKMeans2 vs. Lloyd vs. Hamerly >>>\n");
+
+	CvRNG rng = cvRNG(0x12345678);
+	CvMat * pChannels = createChannels(pInputImage, 1024 * 1024, nClusters, &rng);
+	CvTermCriteria criteria = cvTermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.001);
+	int nRows = pChannels->rows;
+
+	CvMat * pCvLabels = cvCreateMat(nRows, 1, CV_32SC1);
+	CvMat * pLabels = cvCreateMat(nRows, 1, CV_32SC1);
+
+	printf("%d rows x %d channels, %d clusters\n", nRows, pChannels->cols, nClusters);
+
+	DWORD time1 = GetTickCount();
+	cvKMeans2(pChannels, nClusters, pCvLabels, criteria);
+	DWORD time2 = GetTickCount();
+	DWORD cvTime = time2 - time1;
+	printf("cvKMeans2          time=%6ld ms\n", cvTime);
+
+	int nAlgorithms[3] = { KMEANS_LLOYD, KMEANS_LLOYD, KMEANS_HAMERLY };
+	int nSeedings[3] = { KMEANS_SEED_RANDOM, KMEANS_SEED_PLUSPLUS, KMEANS_SEED_PLUSPLUS };
+	const char * strNames[3] = { "Lloyd, random", "Lloyd, k-means++", "Hamerly, k-means++" };
+
+	for (int m = 0; m < 3; m++) {
+		CvRNG initRng = cvRNG(0x87654321);
+		CFloatFeatures features(pChannels);
+		CKMeans<CFloatFeatures> kmeans(features, nClusters, nAlgorithms[m], nSeedings[m]);
+
+		time1 = GetTickCount();
+		int nIter = kmeans.Run(pLabels, criteria, &initRng);
+		time2 = GetTickCount();
+
+		const vector<double>& distances = kmeans.GetDistanceCounts();
+		double dTotal = 0;
+		for (unsigned int i = 0; i < distances.size(); i++)
+			dTotal += distances[i];
+
+		printf("%-18s time=%6ld ms (x%.2f), iterations=%3d, distances=%.3g (%.1f per row), label agreement with cvKMeans2=%.4f\n",
+			strNames[m], time2 - time1, (double)cvTime / MAX(time2 - time1, 1), nIter,
+			dTotal, dTotal / nRows, labelAgreement(pCvLabels, pLabels, nClusters));
+
+		// Relative to the nRows * nClusters distances of a full assignment
+		printf("  distances per iteration (%% of rows x clusters): seeding=%.1f", 
+			100.0 * distances[0] / ((double)nRows * nClusters));
+		for (unsigned int i = 1; i < distances.size(); i++)
+			printf("%s%.1f", (i == 1) ? ", iterations=" : " ", 100.0 * distances[i] / ((double)nRows * nClusters));
+		printf("\n");
+	}
+
+	cvReleaseMat(&pLabels);
+	cvReleaseMat(&pCvLabels);
+	cvReleaseMat(&pChannels);
+}
+
+void Benchmark::kmeansThreads(IplImage * pInputImage, int nClusters)
+{
+	printf("<<< k-means: thread scaling >>>\n");
+
+#ifndef _OPENMP
+	printf("Built without OpenMP, nothing to compare.\n");
+#else
+	CvRNG rng = cvRNG(0x12345678);
+	CvMat * pChannels = createChannels(pInputImage, BENCH_KMEANS_ROWS, nClusters, &rng);
+	CvTermCriteria criteria = cvTermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.001);
+	CvMat * pLabels = cvCreateMat(pChannels->rows, 1, CV_32SC1);
+	CFloatFeatures features(pChannels);
+
+	int nMaxThreads = omp_get_num_procs();
+	int nAlgorithms[2] = { KMEANS_LLOYD, KMEANS_HAMERLY };
+	const char * strAlgorithms[2] = { "Lloyd", "Hamerly" };
+
+	printf("%d rows x %d channels, %d clusters, %d processors\n", 
+		pChannels->rows, pChannels->cols, nClusters, nMaxThreads);
+	for (int m = 0; m < 2; m++) {
+		DWORD baseTime = 0;
+
+		for (int nThreads = 1; nThreads <= nMaxThreads; nThreads *= 2) {
+			omp_set_num_threads(nThreads);
+
+			// The same seeding, so every run does the same iterations
+			CvRNG initRng = cvRNG(0x87654321);
+			CKMeans<CFloatFeatures> kmeans(features, nClusters, nAlgorithms[m], KMEANS_SEED_PLUSPLUS);
+
+			DWORD time1 = GetTickCount();
+			int nIter = kmeans.Run(pLabels, criteria, &initRng);
+			DWORD time2 = GetTickCount();
+
+			if (nThreads == 1)
+				baseTime = time2 - time1;
+
+			printf("%-7s threads=%2d iterations=%3d time=%7ld ms speedup=%.2f\n", 
+				strAlgorithms[m], nThreads, nIter, time2 - time1, 
+				(double)baseTime / MAX(time2 - time1, 1));
+		}
+	}
+	omp_set_num_threads(nMaxThreads);
+
+	cvReleaseMat(&pLabels);
+	cvReleaseMat(&pChannels);
+#endif
+}
+
+double Benchmark::boundaryAgreement(const CvMat * pLabels1, const CvMat * pLabels2, int nWidth, int nHeight)
+{
+	IplImage * pBoundaries[2], * pDilated[2];
+	const CvMat * pLabels[2] = { pLabels1, pLabels2 };
+
+	for (int m = 0; m < 2; m++) {
+		pBoundaries[m] = cvCreateImage(cvSize(nWidth, nHeight), IPL_DEPTH_8U, 1);
+		pDilated[m] = cvCreateImage(cvSize(nWidth, nHeight), IPL_DEPTH_8U, 1);
+
+		// A pixel is on a boundary if its right or lower neighbour is in another cluster
+		const int * pData = pLabels[m]->data.i;
+		for (int y = 0; y < nHeight; y++) {
+			uchar * pRow = (uchar *)pBoundaries[m]->imageData + y * pBoundaries[m]->widthStep;
+			for (int x = 0; x < nWidth; x++) {
+				int nLabel = pData[y * nWidth + x];
+				bool fBoundary = (x < nWidth - 1 && pData[y * nWidth + x + 1] != nLabel) ||
+					(y < nHeight - 1 && pData[(y + 1) * nWidth + x] != nLabel);
+				pRow[x] = fBoundary ? 255 : 0;
+			}
+		}
+		cvDilate(pBoundaries[m], pDilated[m], NULL, 2);
+	}
+
+	int nBoundary1 = cvCountNonZero(pBoundaries[0]);
+	int nBoundary2 = cvCountNonZero(pBoundaries[1]);
+
+	// The boundaries of each labeling near the boundaries of the other
+	cvAnd(pBoundaries[1], pDilated[0], pDilated[0]);
+	cvAnd(pBoundaries[0], pDilated[1], pDilated[1]);
+	double dPrecision = (double)cvCountNonZero(pDilated[0]) / MAX(nBoundary2, 1);
+	double dRecall = (double)cvCountNonZero(pDilated[1]) / MAX(nBoundary1, 1);
+
+	for (int m = 0; m < 2; m++) {
+		cvReleaseImage(&pDilated[m]);
+		cvReleaseImage(&pBoundaries[m]);
+	}
+
+	if (dPrecision + dRecall == 0)
+		return 0;
+	return 2 * dPrecision * dRecall / (dPrecision + dRecall);
+}
+
+void Benchmark::superpixels(IplImage * pInputImage, int nClusters)
+{
+	printf("<<< Clustering: pixels vs. superpixels >>>\n");
+
+	IplImage * pImg = createImage(pInputImage, 1024, nClusters);
+
+	// The features of the pipeline, on the blurred image
+	IplImage * pSmoothImg = cvCreateImage(cvGetSize(pImg), pImg->depth, pImg->nChannels);
+	cvSmooth(pImg, pSmoothImg, CV_BLUR);
+
+	CFeatureExtraction extractor(pSmoothImg);
+	extractor.run();
+	CvMat * pPrincipalChannels = extractor.GetPrincipalChannels();
+
+	int nWidth = pImg->width, nHeight = pImg->height;
+	int nPixels = nWidth * nHeight;
+	CvTermCriteria criteria = cvTermCriteria(CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, 100, 0.001);
+
+	CvMat * pChannels = cvCreateMat(nPixels, PRINCIPAL_CHANNEL_NUM, CV_32F);
+	CvMat * pPixelLabels = cvCreateMat(nPixels, 1, CV_32SC1);
+	CvMat * pLabels = cvCreateMat(nPixels, 1, CV_32SC1);
+
+	printf("%dx%d image, %d clusters\n", nWidth, nHeight, nClusters);
+
+	DWORD time1 = GetTickCount();
+	cvConvertScale(pPrincipalChannels, pChannels, 1 / cvNorm(pPrincipalChannels, 0, CV_C, 0));
+	cvKMeans2(pChannels, nClusters, pPixelLabels, criteria);
+	DWORD time2 = GetTickCount();
+	DWORD pixelTime = time2 - time1;
+	printf("pixels              clustering=%6ld ms\n", pixelTime);
+
+	for (int nSize = 16; nSize <= 1024; nSize *= 4) {
+		time1 = GetTickCount();
+		CSuperpixels superpixels(pSmoothImg, nSize);
+		DWORD time2 = GetTickCount();
+
+		int nCount = superpixels.GetCount();
+		CvMat * pMeans = cvCreateMat(nCount, PRINCIPAL_CHANNEL_NUM, CV_32F);
+		CvMat * pSuperpixelLabels = cvCreateMat(nCount, 1, CV_32SC1);
+
+		superpixels.Put(cvRect(0, 0, nWidth, nHeight), pPrincipalChannels);
+		superpixels.GetMeans(pMeans);
+		cvConvertScale(pMeans, pMeans, 1 / cvNorm(pMeans, 0, CV_C, 0));
+		cvKMeans2(pMeans, nClusters, pSuperpixelLabels, criteria);
+		superpixels.Expand(pSuperpixelLabels, pLabels);
+		DWORD time3 = GetTickCount();
+
+		printf("superpixels=%-6d   slic=%6ld ms, clustering=%6ld ms (x%.2f, x%.2f with slic), "
+			"label agreement=%.4f, boundary F-measure=%.4f\n",
+			nCount, time2 - time1, time3 - time2, 
+			(double)pixelTime / MAX(time3 - time2, 1), (double)pixelTime / MAX(time3 - time1, 1),
+			labelAgreement(pPixelLabels, pLabels, nClusters),
+			boundaryAgreement(pPixelLabels, pLabels, nWidth, nHeight));
+
+		cvReleaseMat(&pSuperpixelLabels);
+		cvReleaseMat(&pMeans);
+	}
+
+	cvReleaseMat(&pLabels);
+	cvReleaseMat(&pPixelLabels);
+	cvReleaseMat(&pChannels);
+	cvReleaseImage(&pSmoothImg);
+	cvReleaseImage(&pImg);
+}
+
+void Benchmark::floodFill()
+{
+	printf("<<< Texton flood fill: recursive vs. scanline >>>\n");
+
+	SMapComparison comparison;
+	comparison.strPass1 = "recursive";
+	comparison.pass1 = floodRecursive;
+	comparison.strPass2 = "scanline";
+	comparison.pass2 = floodScanline;
+	comparison.generator = floodMap;
+	compareMaps(comparison);
+
+	// A single texton over the whole map, too deep for the recursion
+	CvRNG rng = cvRNG(0x12345678);
+	CvScalar background = cvScalarAll(UNDEFINED);
+	for (int nSize = 256; nSize <= 4096; nSize *= 2) {
+		int nPixels = nSize * nSize;
+		IplImage * pImg = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_8U, 3);
+		Textonator textonator(pImg, 1, 0, background);
+
+		int * pMap = new int[nPixels];
+		for (int i = 0; i < nPixels; i++)
+			pMap[i] = (cvRandInt(&rng) % 10 == 0) ? BORDER_DATA : UNCLUSTERED_DATA;
+		pMap[0] = UNCLUSTERED_DATA;
+		textonator.m_nCurTextonSize = 0;
+		DWORD time1 = GetTickCount();
+		textonator.assignTextons(0, 0, pMap, FIRST_TEXTON_NUM);
+		DWORD wholeTime = GetTickCount() - time1;
+
+		printf("%4dx%-4d whole map texton (%d pixels): scanline=%5ld ms\n",
+			nSize, nSize, textonator.m_nCurTextonSize, wholeTime);
+
+		delete [] pMap;
+		cvReleaseImage(&pImg);
+	}
+}
+
+void Benchmark::floodMap(Textonator& /*textonator*/, int * pMap, int nSize, int /*nParam*/, CvRNG * pRng)
+{
+	// 20% out of the segment, 10% edges, and the 32x32 cell walls
+	for (int i = 0; i < nSize * nSize; i++) {
+		int x = i % nSize, y = i / nSize;
+		unsigned int r = cvRandInt(pRng) % 10;
+		if (x % 32 == 31 || y % 32 == 31 || r < 2)
+			pMap[i] = OUT_OF_SEGMENT_DATA;
+		else
+			pMap[i] = (r == 2) ? BORDER_DATA : UNCLUSTERED_DATA;
+	}
+}
+
+int Benchmark::floodTextons(Textonator& textonator, int * pMap, int nSize, bool fRecursive)
+{
+	// Fill every texton, in the order of scanForTextons
+	int nTexton = FIRST_TEXTON_NUM;
+	for (int i = 0; i < nSize; i++) {
+		for (int j = 0; j < nSize; j++) {
+			if (pMap[j * nSize + i] != UNCLUSTERED_DATA)
+				continue;
+			if (fRecursive)
+				assignTextonsRecursive(i, j, pMap, nSize, nTexton++);
+			else
+				textonator.assignTextons(i, j, pMap, nTexton++);
+		}
+	}
+	return nTexton - FIRST_TEXTON_NUM;
+}
+
+void Benchmark::assignTextonsRecursive(int x, int y, int * pMap, int nSize, int nTexton)
+{
+	// The former fill, a call per pixel (the edges are colored but not spread from)
+	int nValue = pMap[y * nSize + x];
+	if (nValue != UNCLUSTERED_DATA && nValue != BORDER_DATA)
+		return;
+
+	pMap[y * nSize + x] = nTexton;
+	if (nValue == BORDER_DATA)
+		return;
+
+	if (x < nSize - 1)
+		assignTextonsRecursive(x + 1, y, pMap, nSize, nTexton);
+	if (x >= 1)
+		assignTextonsRecursive(x - 1, y, pMap, nSize, nTexton);
+	if (y < nSize - 1)
+		assignTextonsRecursive(x, y + 1, pMap, nSize, nTexton);
+	if (y >= 1)
+		assignTextonsRecursive(x, y - 1, pMap, nSize, nTexton);
+}
+
+void Benchmark::floodRecursive(Textonator& textonator, int * pMap, int nSize, char * strReport)
+{
+	sprintf(strReport, "%d textons", floodTextons(textonator, pMap, nSize, true));
+}
+
+void Benchmark::floodScanline(Textonator& textonator, int * pMap, int nSize, char * strReport)
+{
+	sprintf(strReport, "%d textons", floodTextons(textonator, pMap, nSize, false));
+}
+
+void Benchmark::componentLabeling(int nClusters)
+{
+	printf("<<< Texton components: flood fill per cluster vs. union-find >>>\n");
+
+	CvRNG rng = cvRNG(0x12345678);
+	CvScalar background = cvScalarAll(UNDEFINED);
+	int nMinTextonSize = 30;
+	int nMaxThreads = 1;
+#ifdef _OPENMP
+	nMaxThreads = omp_get_max_threads();
+#endif
+
+	for (int nSize = 256; nSize <= 4096; nSize *= 2) {
+		int nPixels = nSize * nSize;
+		IplImage * pImg = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_8U, 3);
+		Textonator textonator(pImg, nClusters, nMinTextonSize, background);
+
+		// 8x8 blocks of random clusters, and 5% edges
+		int * pClusters = new int[nPixels];
+		IplImage * pEdges = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_8U, 1);
+		unsigned int nBlocks = (unsigned int)(nSize / 8);
+		int * pBlockClusters = new int[nBlocks * nBlocks];
+		for (unsigned int i = 0; i < nBlocks * nBlocks; i++)
+			pBlockClusters[i] = cvRandInt(&rng) % nClusters;
+		for (int i = 0; i < nPixels; i++) {
+			int x = i % nSize, y = i / nSize;
+			pClusters[i] = pBlockClusters[(y / 8) * nBlocks + x / 8];
+			pEdges->imageData[y * pEdges->widthStep + x] = (cvRandInt(&rng) % 20 == 0) ? (char)EDGE_DATA : 0;
+		}
+
+		// The flood fill of each cluster, every component is a texton. The textons of the
+		// clusters already filled stop the fill as the other clusters do, so they are kept
+		// and the map ends up with a label per component (BORDER_DATA on the lone edges)
+		int * pMap = new int[nPixels];
+		int nTexton = FIRST_TEXTON_NUM;
+		DWORD time1 = GetTickCount();
+		for (int i = 0; i < nPixels; i++)
+			pMap[i] = OUT_OF_SEGMENT_DATA;
+		for (int k = 0; k < nClusters; k++) {
+			for (int i = 0; i < nPixels; i++) {
+				if (pClusters[i] == k)
+					pMap[i] = ((uchar)pEdges->imageData[(i / nSize) * pEdges->widthStep + i % nSize] == EDGE_DATA) ? 
+						BORDER_DATA : UNCLUSTERED_DATA;
+			}
+
+			for (int i = 0; i < nSize; i++) {
+				for (int j = 0; j < nSize; j++) {
+					if (pMap[j * nSize + i] == UNCLUSTERED_DATA)
+						textonator.assignTextons(i, j, pMap, nTexton++);
+				}
+			}
+		}
+		DWORD floodTime = GetTickCount() - time1;
+		int nFloodComponents = nTexton - FIRST_TEXTON_NUM;
+
+		// Union-find on one thread and on all of them, the labels must not depend on the strips
+		DWORD times[2];
+		int nComponents[2];
+		int * pSerialLabels = new int[nPixels];
+		CComponentLabeler labeler(nSize, nSize);
+		for (int m = 0; m < 2; m++) {
+#ifdef _OPENMP
+			omp_set_num_threads(m == 0 ? 1 : nMaxThreads);
+#endif
+			time1 = GetTickCount();
+			nComponents[m] = labeler.Label(pClusters, (uchar *)pEdges->imageData, pEdges->widthStep);
+			labeler.AttachEdges(pClusters, (uchar *)pEdges->imageData, pEdges->widthStep);
+			times[m] = GetTickCount() - time1;
+
+			if (m == 0)
+				memcpy(pSerialLabels, labeler.GetLabels(), nPixels * sizeof(int));
+		}
+		bool fSame = (nComponents[0] == nFloodComponents && nComponents[1] == nFloodComponents &&
+			!memcmp(pSerialLabels, labeler.GetLabels(), nPixels * sizeof(int)) &&
+			samePartition(pMap, labeler.GetLabels(), nPixels, nFloodComponents));
+
+		printf("%4dx%-4d %7d components: flood fill=%5ld ms, union-find 1 thread=%5ld ms (x%.2f), "
+			"%d threads=%5ld ms (x%.2f), %s\n",
+			nSize, nSize, nComponents[1], floodTime, times[0], (double)floodTime / MAX(times[0], 1),
+			nMaxThreads, times[1], (double)floodTime / MAX(times[1], 1), 
+			fSame ? "same components" : "DIFFERENT COMPONENTS");
+
+		// The textons, once the small ones are rejected. The modes differ there: scanForTextons
+		// returns a rejected texton (its edge pixels too) to the unclustered pixels, so a later
+		// flood fill may cross it and absorb it, while the labeler never merges components
+		memcpy(textonator.m_pClusters->data.i, pClusters, nPixels * sizeof(int));
+		cvCopy(pEdges, textonator.m_pSegmentBoundaries);
+		textonator.m_textonParams.nEdges = TEXTON_EDGES_SHARED;
+		textonator.labelComponents();
+
+		int nFloodTextons = 0, nLabelTextons = 0;
+		bool fBackgroundCluster = false;
+		for (int k = 0; k < nClusters; k++) {
+			nFloodTextons += textonator.scanForTextons(k, fBackgroundCluster, pMap);
+			nLabelTextons += textonator.scanComponents(k, fBackgroundCluster, pMap);
+		}
+		printf("\t  textons larger than %d pixels: flood fill=%d, union-find=%d (%+d)\n",
+			nMinTextonSize, nFloodTextons, nLabelTextons, nLabelTextons - nFloodTextons);
+
+		delete [] pSerialLabels;
+		delete [] pMap;
+		delete [] pBlockClusters;
+		delete [] pClusters;
+		cvReleaseImage(&pEdges);
+		cvReleaseImage(&pImg);
+	}
+#ifdef _OPENMP
+	omp_set_num_threads(nMaxThreads);
+#endif
+}
+
+bool Benchmark::samePartition(const int * pFloodMap, const int * pLabels, int nPixels, int nComponents)
+{
+	// The textons and the components must match one to one, and the lone edges be the same pixels
+	vector<int> floodToLabel(nComponents, -1);
+	vector<int> labelToFlood(nComponents, -1);
+	for (int i = 0; i < nPixels; i++) {
+		if (pFloodMap[i] < FIRST_TEXTON_NUM || pLabels[i] < 0) {
+			if (pFloodMap[i] >= FIRST_TEXTON_NUM || pLabels[i] >= 0)
+				return false;
+			continue;
+		}
+
+		int nFlood = pFloodMap[i] - FIRST_TEXTON_NUM;
+		if (nFlood >= nComponents || pLabels[i] >= nComponents)
+			return false;
+		if (floodToLabel[nFlood] < 0 && labelToFlood[pLabels[i]] < 0) {
+			floodToLabel[nFlood] = pLabels[i];
+			labelToFlood[pLabels[i]] = nFlood;
+		}
+		else if (floodToLabel[nFlood] != pLabels[i] || labelToFlood[pLabels[i]] != nFlood)
+			return false;
+	}
+	return true;
+}
+
+void Benchmark::textonRejection()
+{
+	printf("<<< Small texton rejection: whole map rescan vs. recorded pixels >>>\n");
+
+	SMapComparison comparison;
+	comparison.strPass1 = "rescan";
+	comparison.pass1 = rejectionRescan;
+	comparison.strPass2 = "recorded";
+	comparison.pass2 = rejectionRecorded;
+	comparison.generator = rejectionMap;
+	comparison.nMinSize = 128;
+	comparison.nMaxSize1 = 1024;
+	comparison.nMinTextonSize = 30;
+	compareMaps(comparison);
+}
+
+void Benchmark::rejectionMap(Textonator& textonator, int * pMap, int nSize, int /*nParam*/, CvRNG * pRng)
+{
+	// Each pixel in one of two clusters at random, and 5% edges
+	for (int i = 0; i < nSize * nSize; i++) {
+		textonator.m_pClusters->data.i[i] = cvRandInt(pRng) % 2;
+		textonator.m_pSegmentBoundaries->imageData[(i / nSize) * textonator.m_pSegmentBoundaries->widthStep + i % nSize] = 
+			(cvRandInt(pRng) % 20 == 0) ? (char)EDGE_DATA : 0;
+	}
+	textonator.colorTextonMap((uchar *)textonator.m_pSegmentBoundaries->imageData, pMap, 0);
+}
+
+void Benchmark::rejectionRescan(Textonator& textonator, int * pMap, int nSize, char * strReport)
+{
+	// The former scan, which rescans the whole map for each small texton
+	textonator.colorTextonMap((uchar *)textonator.m_pSegmentBoundaries->imageData, pMap, 0);
+	int nTexton = FIRST_TEXTON_NUM;
+	for (int i = 0; i < nSize; i++) {
+		for (int j = 0; j < nSize; j++) {
+			if (pMap[j * nSize + i] != UNCLUSTERED_DATA)
+				continue;
+
+			textonator.m_nCurTextonSize = 0;
+			textonator.assignTextons(i, j, pMap, nTexton);
+			if (textonator.m_nCurTextonSize > textonator.m_nMinTextonSize) {
+				nTexton++;
+				continue;
+			}
+			for (int p = 0; p < nSize * nSize; p++) {
+				if (pMap[p] == nTexton)
+					pMap[p] = UNCLUSTERED_DATA;
+			}
+		}
+	}
+	sprintf(strReport, "%d textons", nTexton - FIRST_TEXTON_NUM);
+}
+
+void Benchmark::rejectionRecorded(Textonator& textonator, int * pMap, int /*nSize*/, char * strReport)
+{
+	bool fBackgroundCluster = false;
+	sprintf(strReport, "%d textons", textonator.scanForTextons(0, fBackgroundCluster, pMap));
+}
+
+void Benchmark::textonEdges(IplImage * pInputImage, int nClusters)
+{
+	printf("<<< Texton edges: per cluster vs. shared >>>\n");
+
+	IplImage * pImg = createImage(pInputImage, 512, nClusters);
+
+	// Cluster once, every mode extracts the textons of the same clusters
+	CvScalar background = cvScalarAll(UNDEFINED);
+	Textonator textonator(pImg, nClusters, 30, background);
+	textonator.segment();
+
+	const char * modeNames[4] = { "cluster edges, flood fill", "cluster edges, union-find",
+		"shared edges,  flood fill", "shared edges,  union-find" };
+	DWORD times[4];
+	vector<Cluster> clusterLists[4];
+	for (int m = 0; m < 4; m++) {
+		textonator.m_textonParams.nEdges = (m < 2) ? TEXTON_EDGES_CLUSTER : TEXTON_EDGES_SHARED;
+		textonator.m_textonParams.nLabeling = (m % 2 == 0) ? TEXTON_LABELING_FLOOD : TEXTON_LABELING_UNIONFIND;
+
+		DWORD time1 = GetTickCount();
+		textonator.textonizeClusters(clusterLists[m]);
+		times[m] = GetTickCount() - time1;
+	}
+
+	printf("%dx%d image, %d clusters\n", pImg->width, pImg->height, textonator.m_nClusters);
+	for (int m = 0; m < 4; m++) {
+		int nTextons = 0;
+		printf("%s: %6ld ms, textons per cluster:", modeNames[m], times[m]);
+		for (unsigned int k = 0; k < clusterLists[m].size(); k++) {
+			printf(" %d", clusterLists[m][k].m_nClusterSize);
+			nTextons += clusterLists[m][k].m_nClusterSize;
+		}
+		printf(" (%d)\n", nTextons);
+	}
+
+	cvReleaseImage(&pImg);
+}
+
+void Benchmark::remainingData()
+{
+	printf("<<< Remaining pixels assignment: full sweeps vs. frontier >>>\n");
+
+	SMapComparison comparison;
+	comparison.strPass1 = "sweeps";
+	comparison.pass1 = remainingSweeps;
+	comparison.strPass2 = "frontier";
+	comparison.pass2 = remainingFrontier;
+	comparison.generator = remainingMap;
+	comparison.nMaxSize = 2048;
+	comparison.strParam = "band";
+	comparison.nMinParam = 4;
+	comparison.nMaxParam = 32;
+	compareMaps(comparison);
+}
+
+void Benchmark::remainingMap(Textonator& /*textonator*/, int * pMap, int nSize, int nBand, CvRNG * pRng)
+{
+	// 64x64 cells, each a texton but for the bands along its top and left sides, and 2% out of the segment
+	for (int i = 0; i < nSize * nSize; i++) {
+		int x = i % nSize, y = i / nSize;
+		if (cvRandInt(pRng) % 50 == 0)
+			pMap[i] = OUT_OF_SEGMENT_DATA;
+		else if (x % 64 < nBand || y % 64 < nBand)
+			pMap[i] = UNCLUSTERED_DATA;
+		else
+			pMap[i] = FIRST_TEXTON_NUM + (y / 64) * (nSize / 64) + x / 64;
+	}
+}
+
+void Benchmark::remainingSweeps(Textonator& textonator, int * pMap, int nSize, char * strReport)
+{
+	// The former assignRemainingData, full sweeps until no pixel changes
+	int nChanges;
+	textonator.m_nRemainingSweeps = 0;
+	textonator.m_nRemainingVisits = 0;
+	do {
+		nChanges = 0;
+		textonator.m_nRemainingSweeps++;
+
+		for (int i = 0; i < nSize; i++) {
+			for (int j = 0; j < nSize; j++) {
+				if (pMap[j * nSize + i] != UNCLUSTERED_DATA)
+					continue;
+
+				int nClosestTextonColor = textonator.neighborTexton(pMap, i, j);
+				if (nClosestTextonColor != UNDEFINED) {
+					pMap[j * nSize + i] = nClosestTextonColor;
+					nChanges++;
+				}
+			}
+		}
+	} while (nChanges != 0);
+	sprintf(strReport, "%d sweeps, %d visits", textonator.m_nRemainingSweeps, textonator.m_nRemainingVisits);
+}
+
+void Benchmark::remainingFrontier(Textonator& textonator, int * pMap, int /*nSize*/, char * strReport)
+{
+	textonator.assignRemainingData(pMap);
+	sprintf(strReport, "%d sweeps, %d visits", textonator.m_nRemainingSweeps, textonator.m_nRemainingVisits);
+}
+
+void Benchmark::strayPixels()
+{
+	printf("<<< Stray pixels: getNeighbors vs. row majority filter >>>\n");
+
+	SMapComparison comparison;
+	comparison.strPass1 = "getNeighbors";
+	comparison.pass1 = strayNeighbors;
+	comparison.strPass2 = "majority filter";
+	comparison.pass2 = strayFilter;
+	comparison.generator = strayMap;
+	compareMaps(comparison);
+}
+
+void Benchmark::strayMap(Textonator& /*textonator*/, int * pMap, int nSize, int /*nParam*/, CvRNG * pRng)
+{
+	for (int i = 0; i < nSize * nSize; i++) {
+		int x = i % nSize, y = i / nSize;
+		pMap[i] = (cvRandInt(pRng) % 10 == 0) ? OUT_OF_SEGMENT_DATA : FIRST_TEXTON_NUM + ((y / 16) * 7 + x / 16) % 5;
+	}
+}
+
+void Benchmark::strayNeighbors(Textonator& textonator, int * pMap, int nSize, char * /*strReport*/)
+{
+	// The former assignStrayPixels, getNeighbors for each pixel into a copy of the map
+	int nOtherTextons[8];
+	int * pNewMap = new int[nSize * nSize];
+	memset(pNewMap, UNDEFINED, nSize * nSize * sizeof(int));
+
+	for (int i = 0; i < nSize; i++) {
+		for (int j = 0; j < nSize; j++) {
+			memset(nOtherTextons, UNDEFINED, 8 * sizeof(int));
+			if (pMap[j * nSize + i] != OUT_OF_SEGMENT_DATA) {
+				pNewMap[j * nSize + i] = pMap[j * nSize + i];
+				continue;
+			}
+
+			textonator.getNeighbors(pMap, i, j, nSize, nSize, nOtherTextons);
+
+			int nMatchNum = 0;
+			int nTextonNum = -1;
+			for (int k = 0; k < 8; k++) {
+				int nCurMatchNum = 0;
+				for (int l = 0; l < 8; l++) {
+					if (nOtherTextons[k] == nOtherTextons[l])
+						nCurMatchNum++;
+				}
+				if (nCurMatchNum >= 7 && nTextonNum == -1)
+					nTextonNum = nOtherTextons[k];
+				nMatchNum += nCurMatchNum;
+			}
+
+			if (nTextonNum >= FIRST_TEXTON_NUM && nMatchNum >= 7 * 7)
+				pNewMap[j * nSize + i] = nTextonNum;
+		}
+	}
+
+	memcpy(pMap, pNewMap, nSize * nSize * sizeof(int));
+	delete [] pNewMap;
+}
+
+void Benchmark::strayFilter(Textonator& textonator, int * pMap, int /*nSize*/, char * /*strReport*/)
+{
+	textonator.assignStrayPixels(pMap);
+}
+
+static void printPass(const char * strName, DWORD time, const char * strReport)
+{
+	printf("%s=%5ld ms", strName, time);
+	if (strReport[0] != 0)
+		printf(" (%s)", strReport);
+}
+
+void Benchmark::compareMaps(const SMapComparison& comparison)
+{
+	CvRNG rng = cvRNG(0x12345678);
+	CvScalar background = cvScalarAll(UNDEFINED);
+	char strReport1[256], strReport2[256];
+
+	for (int nSize = comparison.nMinSize; nSize <= comparison.nMaxSize; nSize *= 2) {
+		int nPixels = nSize * nSize;
+		IplImage * pImg = cvCreateImage(cvSize(nSize, nSize), IPL_DEPTH_8U, 3);
+		Textonator textonator(pImg, 1, comparison.nMinTextonSize, background);
+
+		int * pMap = new int[nPixels];
+		int * pMap1 = new int[nPixels];
+		for (int nParam = comparison.nMinParam; nParam <= comparison.nMaxParam; nParam *= 2) {
+			comparison.generator(textonator, pMap, nSize, nParam, &rng);
+			memcpy(pMap1, pMap, nPixels * sizeof(int));
+			strReport1[0] = strReport2[0] = 0;
+
+			// The former version may be too slow for the large maps
+			bool fRun1 = (nSize <= comparison.nMaxSize1);
+			DWORD times[2];
+			DWORD time1 = GetTickCount();
+			if (fRun1)
+				comparison.pass1(textonator, pMap1, nSize, strReport1);
+			times[0] = GetTickCount() - time1;
+
+			time1 = GetTickCount();
+			comparison.pass2(textonator, pMap, nSize, strReport2);
+			times[1] = GetTickCount() - time1;
+
+			printf("%4dx%-4d", nSize, nSize);
+			if (comparison.strParam != NULL)
+				printf(" %s=%2d", comparison.strParam, nParam);
+			printf(": ");
+			if (fRun1)
+				printPass(comparison.strPass1, times[0], strReport1);
+			else
+				printf("%s=  skipped", comparison.strPass1);
+			printf(", ");
+			printPass(comparison.strPass2, times[1], strReport2);
+			if (fRun1)
+				printf(", x%.2f, %s", (double)times[0] / MAX(times[1], 1),
+					memcmp(pMap, pMap1, nPixels * sizeof(int)) ? "DIFFERENT MAPS" : "same maps");
+			printf("\n");
+		}
+
+		delete [] pMap1;
+		delete [] pMap;
+		cvReleaseImage(&pImg);
+	}
+}
@@ -0,0 +1,216 @@
+#ifndef __H_BENCHMARK_H__
+#define __H_BENCHMARK_H__
+
+#include <cv.h>
+#include <highgui.h>
+
+class Textonator;
+class CGaborFilterBank;
+
+/**
+ * Timing comparisons between the alternative implementations of the
+ * pipeline stages. Selected from the command line with "-bench [name]".
+ **/
+class Benchmark
+{
+public:
+	/**
+	 * Run the benchmark strName
+	 * @param strName the benchmark name
+	 * @param pInputImage the image given with -i (may be NULL)
+	 * @param nClusters the number of clusters given with -cn
+	 * @return false if there is no such benchmark
+	 **/
+	static bool run(const char * strName, IplImage * pInputImage, int nClusters);
+
+private:
+	/**
+	 * The Gabor bank modes (timing and error relative to the spatial mode, overall and per frequency band), 
+	 * on 256^2 to 4096^2 images. The images larger than 1024^2 are filtered in row strips,
+	 * and only timed
+	 **/
+	static void gabor();
+
+	/**
+	 * Apply the bank on the row strips of nStripRows rows (and the halo of the mode) 
+	 * of pGrayImg, all into pStripMat
+	 **/
+	static void gaborStrips(CGaborFilterBank& bank, IplImage * pGrayImg, CvMat * pStripMat, int nStripRows);
+
+	/**
+	 * Gabor bank speedup as the number of worker threads grows
+	 * @param pInputImage the image to filter, a random 1024^2 image if NULL
+	 **/
+	static void threads(IplImage * pInputImage);
+
+	/**
+	 * k-means throughput on float, half and 8 bit channels, and the agreement
+	 * of the compact labels with the float ones
+	 * @param pInputImage the principal channels of this image are clustered,
+	 * or a random mixture of gaussians if NULL
+	 **/
+	static void compact(IplImage * pInputImage);
+
+	/**
+	 * cvKMeans2 vs. CKMeans (Lloyd, random and k-means++ seeding, and Hamerly):
+	 * wall time, and the distance evaluations of each iteration
+	 * @param pInputImage the principal channels of this image are clustered,
+	 * or a random mixture of gaussians if NULL
+	 **/
+	static void kmeans(IplImage * pInputImage, int nClusters);
+
+	/**
+	 * CKMeans (Lloyd and Hamerly) speedup as the number of worker threads grows
+	 * @param pInputImage the principal channels of this image are clustered,
+	 * or a 2048x1024 mixture of gaussians if NULL
+	 **/
+	static void kmeansThreads(IplImage * pInputImage, int nClusters);
+
+	/**
+	 * Per pixel clustering vs. clustering SLIC superpixels of 16 to 1024 pixels:
+	 * time, and the agreement of the labels and of the cluster boundaries
+	 * @param pInputImage the image to segment, a random mosaic if NULL
+	 **/
+	static void superpixels(IplImage * pInputImage, int nClusters);
+
+	/**
+	 * Textonator::assignTextons (scanline) vs. the recursive fill, on random texton
+	 * maps of 256^2 to 4096^2 cut into 32x32 cells (so the recursion fits the stack),
+	 * and the scanline fill of a texton that covers the whole map
+	 **/
+	static void floodFill();
+
+	/**
+	 * The flood fill of each cluster (as scanForTextons does) vs. CComponentLabeler 
+	 * on one thread and on all of them, on random cluster maps of 256^2 to 4096^2,
+	 * and whether they cut the pixels (edges included) into the same components. Then the number of textons 
+	 * scanForTextons and scanComponents keep once the small ones are rejected, 
+	 * which differ (see Textonator::labelComponents)
+	 **/
+	static void componentLabeling(int nClusters);
+
+	/**
+	 * Textonator::scanForTextons undoing the small textons from their recorded pixels
+	 * vs. by rescanning the whole texton map, on random noise clusters of 128^2 to 
+	 * 4096^2 (the rescan only up to 1024^2), where almost every texton is too small
+	 **/
+	static void textonRejection();
+
+	/**
+	 * Texton extraction with the per cluster edges vs. the shared edges (flood fill
+	 * and union-find labeling each): time and the number of textons of each cluster
+	 * @param pInputImage the image to textonize (e.g. those of testing/src/test.conf),
+	 * a random mosaic if NULL
+	 **/
+	static void textonEdges(IplImage * pInputImage, int nClusters);
+
+	/**
+	 * Textonator::assignRemainingData (frontier) vs. the full sweeps, on 256^2 to 2048^2
+	 * maps of textons separated by unclustered bands 4 to 32 pixels wide:
+	 * time, pixel visits and sweeps, and whether the maps are the same
+	 **/
+	static void remainingData();
+
+	/**
+	 * Textonator::assignStrayPixels (row majority filter) vs. getNeighbors for each pixel, 
+	 * on 256^2 to 4096^2 maps of 16x16 textons with 10% out of segment pixels:
+	 * time, and whether the maps are the same
+	 **/
+	static void strayPixels();
+
+	/**
+	 * Fill pMap (or the clusters and edges of textonator) for the setting nParam
+	 **/
+	typedef void (*MapGenerator)(Textonator& textonator, int * pMap, int nSize, int nParam, CvRNG * pRng);
+
+	/**
+	 * A version of a texton map pass, which may describe its run (textons, visits...) in strReport
+	 **/
+	typedef void (*MapPass)(Textonator& textonator, int * pMap, int nSize, char * strReport);
+
+	/**
+	 * The former and the new version of a texton map pass, on the maps of a generator
+	 **/
+	struct SMapComparison
+	{
+		SMapComparison():nMinSize(256),nMaxSize(4096),nMaxSize1(4096),
+			strParam(NULL),nMinParam(1),nMaxParam(1),nMinTextonSize(0) {}
+
+		const char *	strPass1;
+		MapPass			pass1;
+		const char *	strPass2;
+		MapPass			pass2;
+		MapGenerator	generator;
+
+		// nMinSize^2 to nMaxSize^2 maps, pass1 only up to nMaxSize1^2 (it may be too slow)
+		int				nMinSize;
+		int				nMaxSize;
+		int				nMaxSize1;
+
+		// The generator setting, from nMinParam to nMaxParam (doubling), printed if strParam is given
+		const char *	strParam;
+		int				nMinParam;
+		int				nMaxParam;
+
+		int				nMinTextonSize;
+	};
+
+	/**
+	 * Time both passes of the comparison on the same maps, and print whether they give the same maps
+	 **/
+	static void compareMaps(const SMapComparison& comparison);
+
+	/**
+	 * Whether a flood filled map (of nComponents textons over all the clusters) and
+	 * the labels of CComponentLabeler cut the pixels into the same components
+	 **/
+	static bool samePartition(const int * pFloodMap, const int * pLabels, int nPixels, int nComponents);
+
+	// The maps and the passes of floodFill
+	static void floodMap(Textonator& textonator, int * pMap, int nSize, int nParam, CvRNG * pRng);
+	static int floodTextons(Textonator& textonator, int * pMap, int nSize, bool fRecursive);
+	static void assignTextonsRecursive(int x, int y, int * pMap, int nSize, int nTexton);
+	static void floodRecursive(Textonator& textonator, int * pMap, int nSize, char * strReport);
+	static void floodScanline(Textonator& textonator, int * pMap, int nSize, char * strReport);
+
+	// of textonRejection
+	static void rejectionMap(Textonator& textonator, int * pMap, int nSize, int nParam, CvRNG * pRng);
+	static void rejectionRescan(Textonator& textonator, int * pMap, int nSize, char * strReport);
+	static void rejectionRecorded(Textonator& textonator, int * pMap, int nSize, char * strReport);
+
+	// of remainingData
+	static void remainingMap(Textonator& textonator, int * pMap, int nSize, int nBand, CvRNG * pRng);
+	static void remainingSweeps(Textonator& textonator, int * pMap, int nSize, char * strReport);
+	static void remainingFrontier(Textonator& textonator, int * pMap, int nSize, char * strReport);
+
+	// and of strayPixels
+	static void strayMap(Textonator& textonator, int * pMap, int nSize, int nParam, CvRNG * pRng);
+	static void strayNeighbors(Textonator& textonator, int * pMap, int nSize, char * strReport);
+	static void strayFilter(Textonator& textonator, int * pMap, int nSize, char * strReport);
+
+	/**
+	 * The normalized principal channels of an image, or nRows rows drawn 
+	 * from a mixture of nClusters gaussians if pInputImage is NULL
+	 **/
+	static CvMat * createChannels(IplImage * pInputImage, int nRows, int nClusters, CvRNG * pRng);
+
+	/**
+	 * A copy of pInputImage, or an nSize x nSize image of 64x64 blocks of noise 
+	 * around one of nClusters colors if pInputImage is NULL
+	 **/
+	static IplImage * createImage(IplImage * pInputImage, int nSize, int nClusters);
+
+	/**
+	 * The fraction of rows with the same label, after matching the clusters
+	 * of the two labelings greedily (largest overlap first)
+	 **/
+	static double labelAgreement(const CvMat * pLabels1, const CvMat * pLabels2, int nClusters);
+
+	/**
+	 * The F-measure of the cluster boundaries of two labelings of an image,
+	 * a boundary pixel matches if the other labeling has one within 2 pixels
+	 **/
+	static double boundaryAgreement(const CvMat * pLabels1, const CvMat * pLabels2, int nWidth, int nHeight);
+};
+
+#endif	//__H_BENCHMARK_H__
@@ -0,0 +1,186 @@
+#include "ComponentLabeler.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Strips shorter than this are not worth a thread
+#define LABELER_MIN_STRIP_ROWS	32
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CComponentLabeler::CComponentLabeler(int nWidth, int nHeight)
+:m_nWidth(nWidth),m_nHeight(nHeight)
+{
+	m_pLabels = new int[m_nWidth * m_nHeight];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CComponentLabeler::~CComponentLabeler()
+{
+	delete [] m_pLabels;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+int CComponentLabeler::Find(int p)
+{
+	int nRoot = p;
+	while (m_pLabels[nRoot] != nRoot)
+		nRoot = m_pLabels[nRoot];
+
+	// Path compression
+	while (m_pLabels[p] != nRoot) {
+		int nParent = m_pLabels[p];
+		m_pLabels[p] = nRoot;
+		p = nParent;
+	}
+	return nRoot;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CComponentLabeler::Union(int p, int q)
+{
+	p = Find(p);
+	q = Find(q);
+
+	// The smaller index is the root, so every parent precedes its children
+	if (p < q)
+		m_pLabels[q] = p;
+	else if (q < p)
+		m_pLabels[p] = q;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CComponentLabeler::LabelStrip(const int * pClasses, const uchar * pEdges, int nEdgeStep, int nFirstRow, int nLastRow)
+{
+	for (int y=nFirstRow;y<nLastRow;y++)
+	{
+		const uchar * pEdgeRow = (pEdges != NULL) ? pEdges + y*nEdgeStep : NULL;
+
+		for (int x=0;x<m_nWidth;x++)
+		{
+			int p = y*m_nWidth + x;
+			if (pEdgeRow != NULL && pEdgeRow[x] != 0) {
+				m_pLabels[p] = -1;
+				continue;
+			}
+
+			m_pLabels[p] = p;
+			if (x > 0 && m_pLabels[p-1] >= 0 && pClasses[p-1] == pClasses[p])
+				Union(p, p-1);
+			if (y > nFirstRow && m_pLabels[p-m_nWidth] >= 0 && pClasses[p-m_nWidth] == pClasses[p])
+				Union(p, p-m_nWidth);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+int CComponentLabeler::Label(const int * pClasses, const uchar * pEdges, int nEdgeStep)
+{
+	int nStrips = 1;
+#ifdef _OPENMP
+	nStrips = MIN(omp_get_max_threads(), MAX(m_nHeight / LABELER_MIN_STRIP_ROWS, 1));
+#endif
+	int nStripRows = (m_nHeight + nStrips - 1) / nStrips;
+
+	// First pass, each strip only touches its own pixels
+#pragma omp parallel for schedule(static)
+	for (int s=0;s<nStrips;s++)
+		LabelStrip(pClasses, pEdges, nEdgeStep, s*nStripRows, MIN((s + 1)*nStripRows, m_nHeight));
+
+	// Unite the strips along their borders
+	for (int s=1;s<nStrips;s++)
+	{
+		int y = s*nStripRows;
+		if (y >= m_nHeight)
+			break;
+
+		for (int x=0;x<m_nWidth;x++)
+		{
+			int p = y*m_nWidth + x;
+			if (m_pLabels[p] >= 0 && m_pLabels[p-m_nWidth] >= 0 && pClasses[p-m_nWidth] == pClasses[p])
+				Union(p, p-m_nWidth);
+		}
+	}
+
+	// Second pass, the parent of a pixel precedes it, so it already has its final label
+	m_components.clear();
+	for (int y=0;y<m_nHeight;y++)
+	{
+		for (int x=0;x<m_nWidth;x++)
+		{
+			int p = y*m_nWidth + x;
+			if (m_pLabels[p] < 0)
+				continue;
+
+			if (m_pLabels[p] == p) {
+				SComponent component = { pClasses[p], 0, x, y, x, y, x, y };
+				m_components.push_back(component);
+				m_pLabels[p] = (int)m_components.size() - 1;
+			}
+			else
+				m_pLabels[p] = m_pLabels[m_pLabels[p]];
+
+			SComponent& component = m_components[m_pLabels[p]];
+			component.nArea++;
+			component.nMinX = MIN(component.nMinX, x);
+			component.nMaxX = MAX(component.nMaxX, x);
+			component.nMaxY = y;
+			if (x < component.nSeedX) {
+				component.nSeedX = x;
+				component.nSeedY = y;
+			}
+		}
+	}
+
+	return (int)m_components.size();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CComponentLabeler::AttachEdges(const int * pClasses, const uchar * pEdges, int nEdgeStep)
+{
+	for (int y=0;y<m_nHeight;y++)
+	{
+		for (int x=0;x<m_nWidth;x++)
+		{
+			int p = y*m_nWidth + x;
+			if (pEdges[y*nEdgeStep + x] == 0)
+				continue;
+
+			int neighbours[4] = { x > 0 ? p-1 : -1, y > 0 ? p-m_nWidth : -1,
+				x < m_nWidth-1 ? p+1 : -1, y < m_nHeight-1 ? p+m_nWidth : -1 };
+
+			// The flood fill fills the components in the order of their seeds
+			int nOwner = -1;
+			for (int n=0;n<4;n++)
+			{
+				int q = neighbours[n];
+				if (q < 0 || pClasses[q] != pClasses[p] || pEdges[(q / m_nWidth)*nEdgeStep + q % m_nWidth] != 0)
+					continue;
+
+				const SComponent& candidate = m_components[m_pLabels[q]];
+				if (nOwner < 0 || candidate.nSeedX < m_components[nOwner].nSeedX ||
+					(candidate.nSeedX == m_components[nOwner].nSeedX && candidate.nSeedY < m_components[nOwner].nSeedY))
+					nOwner = m_pLabels[q];
+			}
+			if (nOwner < 0)
+				continue;
+
+			m_pLabels[p] = nOwner;
+			SComponent& component = m_components[nOwner];
+			component.nArea++;
+			component.nMinX = MIN(component.nMinX, x);
+			component.nMinY = MIN(component.nMinY, y);
+			component.nMaxX = MAX(component.nMaxX, x);
+			component.nMaxY = MAX(component.nMaxY, y);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,86 @@
+#ifndef __H_COMPONENT_LABELER_H__
+#define __H_COMPONENT_LABELER_H__
+
+#include <cv.h>
+#include <vector>
+
+using std::vector;
+
+/**
+ * A connected component of the labeling
+ **/
+struct SComponent
+{
+	int		nClass;
+	int		nArea;
+	int		nMinX;
+	int		nMinY;
+	int		nMaxX;
+	int		nMaxY;
+
+	// The first pixel in column-major order, where the flood fill would start it
+	int		nSeedX;
+	int		nSeedY;
+};
+
+/**
+ * Two pass union-find labeling of the 4-connected components of equal class
+ * pixels (e.g. of every cluster at once), which are not edge pixels.
+ * The first pass unites each pixel with its left and upper neighbours, on row
+ * strips in parallel, then the strips are united along their borders.
+ * The union-find forest is kept in the label array itself: a root is the
+ * smallest pixel index of its component, so the second raster pass can give
+ * each pixel the final label of its parent, and collects the area, the
+ * bounding box and the seed of the components as it goes.
+ **/
+class CComponentLabeler
+{
+	public:
+		CComponentLabeler(int nWidth, int nHeight);
+		virtual ~CComponentLabeler();
+
+		/**
+		 * @param pClasses a class per pixel, in raster order
+		 * @param pEdges 8 bit edge map (nonzero on the edges) of row step nEdgeStep, or NULL
+		 * @return the number of components
+		 **/
+		int Label(const int * pClasses, const uchar * pEdges, int nEdgeStep);
+
+		/**
+		 * Give each edge pixel to the component of its class that it touches
+		 * with the first seed in column-major order, the one that the flood fill
+		 * reaches it from. The edge pixels do not join components together,
+		 * and the ones that touch none keep the label -1
+		 **/
+		void AttachEdges(const int * pClasses, const uchar * pEdges, int nEdgeStep);
+
+		/**
+		 * The component of each pixel, -1 for the edge pixels
+		 **/
+		const int * GetLabels() const						{ return m_pLabels; }
+
+		const vector<SComponent>& GetComponents() const	{ return m_components; }
+
+	protected:
+
+		int Find(int p);
+
+		void Union(int p, int q);
+
+		/**
+		 * First pass over the rows [nFirstRow, nLastRow)
+		 **/
+		void LabelStrip(const int * pClasses, const uchar * pEdges, int nEdgeStep, int nFirstRow, int nLastRow);
+
+	protected:
+
+		int			m_nWidth;
+		int			m_nHeight;
+
+		// The parent of each pixel during the first pass, its component afterwards
+		int *		m_pLabels;
+
+		vector<SComponent>	m_components;
+};
+
+#endif // __H_COMPONENT_LABELER_H__
@@ -0,0 +1,604 @@
+#ifndef __H_KMEANS_H__
+#define __H_KMEANS_H__
+
+#include <cv.h>
+#include <float.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+using std::vector;
+
+#include "fe/CompactFeatures.h"
+
+#define KMEANS_CV				0
+#define KMEANS_LLOYD			1
+#define KMEANS_HAMERLY			2
+#define KMEANS_MINIBATCH		3
+
+#define KMEANS_SEED_RANDOM		0
+#define KMEANS_SEED_PLUSPLUS	1
+
+/**
+ * Parameters of the clustering of the principal channels
+ **/
+class SClusterParams
+{
+public:
+	SClusterParams():nStorage(FEATURE_STORAGE_FLOAT),nAlgorithm(KMEANS_CV),nSeeding(KMEANS_SEED_PLUSPLUS),
+		nBatchSize(1024),nBatchIterations(100),nSuperpixelSize(0),nSweepMin(0),nSweepMax(0) {}
+
+	// FEATURE_STORAGE_FLOAT clusters the float channels, 
+	// the compact storage modes cluster a packed copy of them
+	int		nStorage;
+
+	// KMEANS_CV (cvKMeans2, float storage only), one of the CKMeans algorithms,
+	// or KMEANS_MINIBATCH (CMiniBatchKMeans, float storage only)
+	int		nAlgorithm;
+
+	// The initial centers of CKMeans
+	int		nSeeding;
+
+	// KMEANS_MINIBATCH: the rows of a batch, and the number of batches.
+	// With tiled feature extraction the batches are drawn from a sample of
+	// nBatchSize*nBatchIterations rows
+	int		nBatchSize;
+	int		nBatchIterations;
+
+	// Cluster the mean features of SLIC superpixels of about this many pixels
+	// instead of the pixels themselves, 0 to cluster the pixels
+	int		nSuperpixelSize;
+
+	// Cluster once for each cluster count in [nSweepMin, nSweepMax], each run warm 
+	// started from the centers of the previous one, and keep the best scoring one.
+	// 0 to use the given cluster count
+	int		nSweepMin;
+	int		nSweepMax;
+};
+
+/**
+ * k-means over the rows of a feature view
+ * (CFloatFeatures, CHalfFeatures or CByteFeatures).
+ * The distances are computed by the view, on its own storage.
+ * KMEANS_LLOYD computes all the distances of every iteration.
+ * KMEANS_HAMERLY keeps an upper bound on the distance of each row from its center, 
+ * and a lower bound on the distance from all the other centers, and skips the rows 
+ * whose bounds prove their label can not change (Hamerly, "Making k-means even faster").
+ * The rows are split between the OpenMP threads, the centers are updated from
+ * per-thread partial sums.
+ **/
+template <class TFeatures>
+class CKMeans
+{
+	public:
+		CKMeans(const TFeatures& features, int nClusters, 
+			int nAlgorithm = KMEANS_LLOYD, int nSeeding = KMEANS_SEED_RANDOM);
+		virtual ~CKMeans();
+
+		/**
+		 * Cluster the rows.
+		 * Stops after criteria.max_iter iterations, or when no center
+		 * moved more than criteria.epsilon (like cvKMeans2)
+		 * @param pLabels [out] rows x 1 32S matrix
+		 * @return the number of iterations
+		 **/
+		int Run(CvMat * pLabels, CvTermCriteria criteria, CvRNG * pRng);
+
+		/**
+		 * Warm start: the first nCenters centers of the next Run, 
+		 * the seeding only draws the others
+		 * @param pCenters nCenters x cols floats (e.g. the centers of a run with fewer clusters)
+		 **/
+		void SetInitialCenters(const float * pCenters, int nCenters);
+
+		/**
+		 * Calinski-Harabasz index of the labeling by the current centers:
+		 * (between cluster dispersion / (k-1)) / (within cluster dispersion / (rows-k)).
+		 * Higher for compact clusters that are far from each other
+		 **/
+		double GetScore(const CvMat * pLabels);
+
+		const float * GetCenter(int nCluster) const	{ return m_pCenters + nCluster*m_nCols; }
+
+		/**
+		 * The number of row to center distances computed by the seeding (0),
+		 * and by each iteration (1..), the last one is the final labeling
+		 **/
+		const vector<double>& GetDistanceCounts() const	{ return m_distanceCounts; }
+
+	protected:
+
+		/**
+		 * nClusters random rows
+		 **/
+		void SeedRandom(CvRNG * pRng);
+
+		/**
+		 * k-means++: each center is a row drawn with probability proportional
+		 * to its squared distance from the nearest center so far
+		 **/
+		void SeedPlusPlus(CvRNG * pRng);
+
+		void PrepareCenters();
+
+		/**
+		 * Assign every row to its nearest center
+		 **/
+		void Assign(int * pLabels);
+
+		/**
+		 * Assign the rows whose bounds do not rule out a change, and tighten their bounds
+		 **/
+		void AssignBounded(int * pLabels);
+
+		/**
+		 * Move each center to the mean of its rows (or to a random row if it has none)
+		 * @return the largest squared move of a center (DBL_MAX if a center was restarted)
+		 **/
+		double Update(const int * pLabels, CvRNG * pRng);
+
+		/**
+		 * Loosen the bounds by the moves of the centers
+		 **/
+		void UpdateBounds(const int * pLabels);
+
+		float CenterDistance(int k1, int k2) const;
+
+	protected:
+
+		const TFeatures&	m_features;
+		int					m_nClusters;
+		int					m_nRows;
+		int					m_nCols;
+		int					m_nAlgorithm;
+		int					m_nSeeding;
+		int					m_nInitialCenters;
+
+		float *				m_pCenters;
+		float *				m_pPrepared;
+		double *			m_pSums;
+		int *				m_pCounts;
+
+		// KMEANS_HAMERLY: the bounds of each row, how far each center moved,
+		// and half the distance of each center from its nearest center
+		float *				m_pUpper;
+		float *				m_pLower;
+		float *				m_pMoves;
+		float *				m_pHalfGap;
+		bool				m_fBounds;
+
+		vector<double>		m_distanceCounts;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+CKMeans<TFeatures>::CKMeans(const TFeatures& features, int nClusters, int nAlgorithm, int nSeeding)
+:m_features(features),m_nClusters(nClusters),m_nAlgorithm(nAlgorithm),m_nSeeding(nSeeding),
+m_nInitialCenters(0),m_pUpper(NULL),m_pLower(NULL),m_fBounds(false)
+{
+	m_nRows = m_features.GetRows();
+	m_nCols = m_features.GetCols();
+
+	m_pCenters = new float[m_nClusters * m_nCols];
+	m_pPrepared = new float[m_nClusters * m_nCols];
+	m_pSums = new double[m_nClusters * m_nCols];
+	m_pCounts = new int[m_nClusters];
+	m_pMoves = new float[m_nClusters];
+	m_pHalfGap = new float[m_nClusters];
+
+	if (m_nAlgorithm == KMEANS_HAMERLY) {
+		m_pUpper = new float[m_nRows];
+		m_pLower = new float[m_nRows];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+CKMeans<TFeatures>::~CKMeans()
+{
+	delete [] m_pLower;
+	delete [] m_pUpper;
+	delete [] m_pHalfGap;
+	delete [] m_pMoves;
+	delete [] m_pCounts;
+	delete [] m_pSums;
+	delete [] m_pPrepared;
+	delete [] m_pCenters;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+int CKMeans<TFeatures>::Run(CvMat * pLabels, CvTermCriteria criteria, CvRNG * pRng)
+{
+	int * pLabelData = pLabels->data.i;
+
+	m_distanceCounts.clear();
+	m_distanceCounts.push_back(0);
+	m_fBounds = false;
+
+	if (m_nSeeding == KMEANS_SEED_PLUSPLUS)
+		SeedPlusPlus(pRng);
+	else
+		SeedRandom(pRng);
+
+	int nMaxIter = (criteria.type & CV_TERMCRIT_ITER) ? criteria.max_iter : 100;
+	double dEpsilon = (criteria.type & CV_TERMCRIT_EPS) ? criteria.epsilon * criteria.epsilon : 0;
+
+	int nIter;
+	for (nIter=1;nIter<=nMaxIter;nIter++)
+	{
+		m_distanceCounts.push_back(0);
+		if (m_nAlgorithm == KMEANS_HAMERLY)
+			AssignBounded(pLabelData);
+		else
+			Assign(pLabelData);
+
+		double dMaxMove = Update(pLabelData, pRng);
+		if (m_nAlgorithm == KMEANS_HAMERLY)
+			UpdateBounds(pLabelData);
+
+		if (dMaxMove <= dEpsilon)
+			break;
+	}
+
+	// The labels of the final centers
+	m_distanceCounts.push_back(0);
+	if (m_nAlgorithm == KMEANS_HAMERLY)
+		AssignBounded(pLabelData);
+	else
+		Assign(pLabelData);
+
+	return MIN(nIter, nMaxIter);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::SetInitialCenters(const float * pCenters, int nCenters)
+{
+	m_nInitialCenters = MIN(nCenters, m_nClusters);
+	memcpy(m_pCenters, pCenters, m_nInitialCenters*m_nCols*sizeof(float));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+double CKMeans<TFeatures>::GetScore(const CvMat * pLabels)
+{
+	const int * pLabelData = pLabels->data.i;
+	int i, k, c;
+
+	if (m_nClusters < 2 || m_nRows <= m_nClusters)
+		return 0;
+
+	PrepareCenters();
+
+	double dWithin = 0;
+#pragma omp parallel for schedule(static) reduction(+:dWithin)
+	for (i=0;i<m_nRows;i++)
+		dWithin += m_features.Distance(i, m_pPrepared + pLabelData[i]*m_nCols);
+
+	memset(m_pCounts, 0, m_nClusters*sizeof(int));
+	for (i=0;i<m_nRows;i++)
+		m_pCounts[pLabelData[i]]++;
+
+	// The mean of all the rows, from the centers
+	memset(m_pSums, 0, m_nCols*sizeof(double));
+	for (k=0;k<m_nClusters;k++)
+		for (c=0;c<m_nCols;c++)
+			m_pSums[c] += (double)m_pCounts[k] * m_pCenters[k*m_nCols+c] / m_nRows;
+
+	double dBetween = 0;
+	for (k=0;k<m_nClusters;k++)
+	{
+		for (c=0;c<m_nCols;c++) {
+			double d = m_pCenters[k*m_nCols+c] - m_pSums[c];
+			dBetween += m_pCounts[k] * d*d;
+		}
+	}
+
+	return (dBetween / (m_nClusters - 1)) / MAX(dWithin / (m_nRows - m_nClusters), DBL_MIN);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::SeedRandom(CvRNG * pRng)
+{
+	for (int k=m_nInitialCenters;k<m_nClusters;k++)
+	{
+		memset(m_pSums, 0, m_nCols*sizeof(double));
+		m_features.AddTo(cvRandInt(pRng) % m_nRows, m_pSums);
+		for (int c=0;c<m_nCols;c++)
+			m_pCenters[k*m_nCols+c] = (float)m_pSums[c];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::SeedPlusPlus(CvRNG * pRng)
+{
+	int i, k, c;
+
+	if (m_nInitialCenters >= m_nClusters)
+		return;
+
+	float * pNearest = new float[m_nRows];
+	int nRow = cvRandInt(pRng) % m_nRows;
+
+	for (k=0;k<m_nClusters;k++)
+	{
+		// The given centers are only taken into the distances
+		float * pCenter = m_pCenters + k*m_nCols;
+		if (k >= m_nInitialCenters) {
+			memset(m_pSums, 0, m_nCols*sizeof(double));
+			m_features.AddTo(nRow, m_pSums);
+			for (c=0;c<m_nCols;c++)
+				pCenter[c] = (float)m_pSums[c];
+		}
+
+		if (k == m_nClusters - 1)
+			break;
+
+		// The squared distance of each row from its nearest center
+		m_features.PrepareCenter(pCenter, m_pPrepared);
+		double dTotal = 0;
+#pragma omp parallel for schedule(static) reduction(+:dTotal)
+		for (i=0;i<m_nRows;i++)
+		{
+			float fDist = m_features.Distance(i, m_pPrepared);
+			if (k == 0 || fDist < pNearest[i])
+				pNearest[i] = fDist;
+			dTotal += pNearest[i];
+		}
+		m_distanceCounts[0] += m_nRows;
+
+		if (k + 1 < m_nInitialCenters)
+			continue;
+
+		// Draw the next center
+		double dTarget = cvRandReal(pRng) * dTotal;
+		for (nRow=0;nRow<m_nRows-1;nRow++)
+		{
+			dTarget -= pNearest[nRow];
+			if (dTarget < 0)
+				break;
+		}
+	}
+
+	delete [] pNearest;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::PrepareCenters()
+{
+	for (int k=0;k<m_nClusters;k++)
+		m_features.PrepareCenter(m_pCenters + k*m_nCols, m_pPrepared + k*m_nCols);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+float CKMeans<TFeatures>::CenterDistance(int k1, int k2) const
+{
+	const float * pCenter1 = m_pCenters + k1*m_nCols;
+	const float * pCenter2 = m_pCenters + k2*m_nCols;
+	float fDist = 0;
+	for (int c=0;c<m_nCols;c++) {
+		float d = pCenter1[c] - pCenter2[c];
+		fDist += d*d;
+	}
+	return sqrtf(fDist);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::Assign(int * pLabels)
+{
+	PrepareCenters();
+
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<m_nRows;i++)
+	{
+		int nBest = 0;
+		float fBest = FLT_MAX;
+		for (int k=0;k<m_nClusters;k++)
+		{
+			float fDist = m_features.Distance(i, m_pPrepared + k*m_nCols);
+			if (fDist < fBest) {
+				fBest = fDist;
+				nBest = k;
+			}
+		}
+		pLabels[i] = nBest;
+	}
+
+	m_distanceCounts.back() += (double)m_nRows * m_nClusters;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::AssignBounded(int * pLabels)
+{
+	int i, k;
+
+	PrepareCenters();
+
+	// No bounds yet, compute them from all the distances
+	if (!m_fBounds) {
+#pragma omp parallel for schedule(static) private(k)
+		for (i=0;i<m_nRows;i++)
+		{
+			float fBest = FLT_MAX, fSecond = FLT_MAX;
+			int nBest = 0;
+			for (k=0;k<m_nClusters;k++)
+			{
+				float fDist = m_features.Distance(i, m_pPrepared + k*m_nCols);
+				if (fDist < fBest) {
+					fSecond = fBest;
+					fBest = fDist;
+					nBest = k;
+				}
+				else if (fDist < fSecond) {
+					fSecond = fDist;
+				}
+			}
+			pLabels[i] = nBest;
+			m_pUpper[i] = sqrtf(fBest);
+			m_pLower[i] = sqrtf(fSecond);
+		}
+		m_distanceCounts.back() += (double)m_nRows * m_nClusters;
+		m_fBounds = true;
+		return;
+	}
+
+	// A row closer to its center than half the gap to the next center stays there
+	for (k=0;k<m_nClusters;k++)
+	{
+		float fGap = FLT_MAX;
+		for (int j=0;j<m_nClusters;j++)
+			if (j != k)
+				fGap = MIN(fGap, CenterDistance(k, j));
+		m_pHalfGap[k] = fGap / 2;
+	}
+
+	double dCount = 0;
+#pragma omp parallel for schedule(static) private(k) reduction(+:dCount)
+	for (i=0;i<m_nRows;i++)
+	{
+		int a = pLabels[i];
+		float fBound = MAX(m_pHalfGap[a], m_pLower[i]);
+		if (m_pUpper[i] <= fBound)
+			continue;
+
+		// Tighten the upper bound and try again
+		m_pUpper[i] = sqrtf(m_features.Distance(i, m_pPrepared + a*m_nCols));
+		dCount++;
+		if (m_pUpper[i] <= fBound)
+			continue;
+
+		float fBest = FLT_MAX, fSecond = FLT_MAX;
+		int nBest = a;
+		for (k=0;k<m_nClusters;k++)
+		{
+			float fDist = (k == a) ? m_pUpper[i]*m_pUpper[i] : m_features.Distance(i, m_pPrepared + k*m_nCols);
+			if (fDist < fBest) {
+				fSecond = fBest;
+				fBest = fDist;
+				nBest = k;
+			}
+			else if (fDist < fSecond) {
+				fSecond = fDist;
+			}
+		}
+		dCount += m_nClusters - 1;
+
+		pLabels[i] = nBest;
+		m_pUpper[i] = sqrtf(fBest);
+		m_pLower[i] = sqrtf(fSecond);
+	}
+
+	m_distanceCounts.back() += dCount;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+double CKMeans<TFeatures>::Update(const int * pLabels, CvRNG * pRng)
+{
+	int i, k, c;
+	bool fRestarted = false;
+
+	memset(m_pSums, 0, m_nClusters*m_nCols*sizeof(double));
+	memset(m_pCounts, 0, m_nClusters*sizeof(int));
+
+	// Every thread sums its rows on its own, the partial sums are added at the end
+#pragma omp parallel
+	{
+		double * pSums = new double[m_nClusters*m_nCols];
+		int * pCounts = new int[m_nClusters];
+		memset(pSums, 0, m_nClusters*m_nCols*sizeof(double));
+		memset(pCounts, 0, m_nClusters*sizeof(int));
+
+#pragma omp for schedule(static)
+		for (i=0;i<m_nRows;i++)
+		{
+			m_features.AddTo(i, pSums + pLabels[i]*m_nCols);
+			pCounts[pLabels[i]]++;
+		}
+
+#pragma omp critical(kmeans_update)
+		{
+			for (int j=0;j<m_nClusters*m_nCols;j++)
+				m_pSums[j] += pSums[j];
+			for (int j=0;j<m_nClusters;j++)
+				m_pCounts[j] += pCounts[j];
+		}
+
+		delete [] pCounts;
+		delete [] pSums;
+	}
+
+	double dMaxMove = 0;
+	for (k=0;k<m_nClusters;k++)
+	{
+		double * pSum = m_pSums + k*m_nCols;
+		float * pCenter = m_pCenters + k*m_nCols;
+
+		if (m_pCounts[k] == 0) {
+			// An empty cluster restarts from a random row
+			memset(pSum, 0, m_nCols*sizeof(double));
+			m_features.AddTo(cvRandInt(pRng) % m_nRows, pSum);
+			m_pCounts[k] = 1;
+			fRestarted = true;
+		}
+
+		double dMove = 0;
+		for (c=0;c<m_nCols;c++)
+		{
+			float fNew = (float)(pSum[c] / m_pCounts[k]);
+			dMove += (fNew - pCenter[c]) * (fNew - pCenter[c]);
+			pCenter[c] = fNew;
+		}
+		m_pMoves[k] = (float)sqrt(dMove);
+		dMaxMove = MAX(dMaxMove, dMove);
+	}
+
+	return fRestarted ? DBL_MAX : dMaxMove;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+template <class TFeatures>
+void CKMeans<TFeatures>::UpdateBounds(const int * pLabels)
+{
+	// The largest and the second largest moves
+	int nFarthest = 0;
+	for (int k=1;k<m_nClusters;k++)
+		if (m_pMoves[k] > m_pMoves[nFarthest])
+			nFarthest = k;
+	float fSecondMove = 0;
+	for (int k=0;k<m_nClusters;k++)
+		if (k != nFarthest)
+			fSecondMove = MAX(fSecondMove, m_pMoves[k]);
+
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<m_nRows;i++)
+	{
+		int a = pLabels[i];
+		m_pUpper[i] += m_pMoves[a];
+		m_pLower[i] -= (a == nFarthest) ? fSecondMove : m_pMoves[nFarthest];
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+#endif	//__H_KMEANS_H__
@@ -0,0 +1,212 @@
+#include "MiniBatchKMeans.h"
+
+// The seeding batch, in batches
+#define MINIBATCH_SEED_BATCHES	3
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CMiniBatchKMeans::CMiniBatchKMeans(int nClusters, int nCols, int nBatchSize, int nIterations, int nSeeding)
+:m_nClusters(nClusters),m_nCols(nCols),m_nBatchSize(nBatchSize),m_nIterations(nIterations),m_nSeeding(nSeeding)
+{
+	m_pCenters = new float[m_nClusters * m_nCols];
+	m_pCounts = new double[m_nClusters];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CMiniBatchKMeans::~CMiniBatchKMeans()
+{
+	delete [] m_pCounts;
+	delete [] m_pCenters;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+int CMiniBatchKMeans::Nearest(const float * pRow, const float * pCenters) const
+{
+	int nBest = 0;
+	float fBest = FLT_MAX;
+
+	for (int k=0;k<m_nClusters;k++)
+	{
+		const float * pCenter = pCenters + k*m_nCols;
+		float fDist;
+		if (m_nCols == PRINCIPAL_CHANNEL_NUM) {
+			fDist = SquaredDistance<PRINCIPAL_CHANNEL_NUM>(pRow, pCenter);
+		}
+		else {
+			fDist = 0;
+			for (int c=0;c<m_nCols;c++) {
+				float d = pRow[c] - pCenter[c];
+				fDist += d*d;
+			}
+		}
+
+		if (fDist < fBest) {
+			fBest = fDist;
+			nBest = k;
+		}
+	}
+	return nBest;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CMiniBatchKMeans::Seed(const CvMat * pSamples, CvRNG * pRng)
+{
+	int nRows = MAX(MINIBATCH_SEED_BATCHES * m_nBatchSize, MINIBATCH_SEED_BATCHES * m_nClusters);
+	nRows = MIN(nRows, pSamples->rows);
+
+	CvMat * pSeedMat = cvCreateMat(nRows, m_nCols, CV_32F);
+	CvMat * pLabels = cvCreateMat(nRows, 1, CV_32SC1);
+
+	for (int i=0;i<nRows;i++)
+	{
+		int nRow = cvRandInt(pRng) % pSamples->rows;
+		memcpy(pSeedMat->data.ptr + i*pSeedMat->step, pSamples->data.ptr + nRow*pSamples->step,
+			m_nCols*sizeof(float));
+	}
+
+	CFloatFeatures features(pSeedMat);
+	CKMeans<CFloatFeatures> kmeans(features, m_nClusters, KMEANS_HAMERLY, m_nSeeding);
+	kmeans.Run(pLabels, cvTermCriteria(CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 10, 0.001), pRng);
+
+	for (int k=0;k<m_nClusters;k++)
+		memcpy(m_pCenters + k*m_nCols, kmeans.GetCenter(k), m_nCols*sizeof(float));
+
+	cvReleaseMat(&pLabels);
+	cvReleaseMat(&pSeedMat);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CMiniBatchKMeans::Fit(const CvMat * pSamples, CvRNG * pRng)
+{
+	int b, c;
+
+	Seed(pSamples, pRng);
+	for (int k=0;k<m_nClusters;k++)
+		m_pCounts[k] = 0;
+
+	int * pBatch = new int[m_nBatchSize];
+	int * pBatchLabels = new int[m_nBatchSize];
+	double * pSums = new double[m_nClusters * m_nCols];
+	int * pBatchCounts = new int[m_nClusters];
+
+	for (int nIter=0;nIter<m_nIterations;nIter++)
+	{
+		for (b=0;b<m_nBatchSize;b++)
+			pBatch[b] = cvRandInt(pRng) % pSamples->rows;
+
+		// The whole batch is assigned to the centers of the previous iteration
+#pragma omp parallel for schedule(static)
+		for (int i=0;i<m_nBatchSize;i++)
+			pBatchLabels[i] = Nearest((const float *)(pSamples->data.ptr + pBatch[i]*pSamples->step), m_pCenters);
+
+		memset(pSums, 0, m_nClusters * m_nCols * sizeof(double));
+		memset(pBatchCounts, 0, m_nClusters * sizeof(int));
+		for (b=0;b<m_nBatchSize;b++)
+		{
+			const float * pRow = (const float *)(pSamples->data.ptr + pBatch[b]*pSamples->step);
+			double * pSum = pSums + pBatchLabels[b]*m_nCols;
+			for (c=0;c<m_nCols;c++)
+				pSum[c] += pRow[c];
+			pBatchCounts[pBatchLabels[b]]++;
+		}
+
+		// The per row steps with the rate 1/(rows of the center so far), done 
+		// at once: the center is the mean of all the rows it got. The first batch
+		// of a center replaces the seed with the mean of its rows
+		for (int k=0;k<m_nClusters;k++)
+		{
+			if (pBatchCounts[k] == 0)
+				continue;
+
+			float * pCenter = m_pCenters + k*m_nCols;
+			double * pSum = pSums + k*m_nCols;
+			double dCount = m_pCounts[k] + pBatchCounts[k];
+			for (c=0;c<m_nCols;c++)
+				pCenter[c] = (float)((pCenter[c] * m_pCounts[k] + pSum[c]) / dCount);
+			m_pCounts[k] = dCount;
+		}
+	}
+
+	delete [] pBatchCounts;
+	delete [] pSums;
+	delete [] pBatchLabels;
+	delete [] pBatch;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CMiniBatchKMeans::Label(const CvMat * pRows, int * pLabels, double dScale) const
+{
+	// The rows are not scaled, the centers are scaled by 1/dScale instead
+	float * pCenters = new float[m_nClusters * m_nCols];
+	for (int i=0;i<m_nClusters * m_nCols;i++)
+		pCenters[i] = (float)(m_pCenters[i] / dScale);
+
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<pRows->rows;i++)
+		pLabels[i] = Nearest((const float *)(pRows->data.ptr + i*pRows->step), pCenters);
+
+	delete [] pCenters;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CReservoirSink::CReservoirSink(int nSize, CvRNG * pRng)
+:m_dSeen(0),m_dNorm(0),m_pRng(pRng)
+{
+	m_pSamples = cvCreateMat(nSize, PRINCIPAL_CHANNEL_NUM, CV_32F);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CReservoirSink::~CReservoirSink()
+{
+	cvReleaseMat(&m_pSamples);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CReservoirSink::Put(CvRect /*tile*/, const CvMat * pRows)
+{
+	m_dNorm = MAX(m_dNorm, cvNorm(pRows, 0, CV_C, 0));
+
+	// Algorithm R: the i-th row replaces a random sample with probability size/i
+	for (int i=0;i<pRows->rows;i++)
+	{
+		double dSample = m_dSeen;
+		if (m_dSeen >= m_pSamples->rows)
+			dSample = floor(cvRandReal(m_pRng) * (m_dSeen + 1));
+		m_dSeen++;
+
+		if (dSample < m_pSamples->rows)
+			memcpy(m_pSamples->data.ptr + (int)dSample*m_pSamples->step, pRows->data.ptr + i*pRows->step,
+				PRINCIPAL_CHANNEL_NUM*sizeof(float));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CvMat * CReservoirSink::GetSamples(CvMat * pView)
+{
+	return cvGetRows(m_pSamples, pView, 0, (int)MIN(m_dSeen, (double)m_pSamples->rows));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CLabelSink::Put(CvRect tile, const CvMat * pRows)
+{
+	m_tileLabels.resize(pRows->rows);
+	m_kmeans.Label(pRows, &m_tileLabels[0], m_dScale);
+
+	for (int r=0;r<tile.height;r++)
+	{
+		memcpy(m_pLabels->data.i + (tile.y + r)*m_nWidth + tile.x,
+			&m_tileLabels[r*tile.width], tile.width*sizeof(int));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,111 @@
+#ifndef __H_MINI_BATCH_KMEANS_H__
+#define __H_MINI_BATCH_KMEANS_H__
+
+#include <cv.h>
+#include <vector>
+
+using std::vector;
+
+#include "fe/FeatureExtraction.h"
+#include "KMeans.h"
+
+/**
+ * Mini-batch k-means (Sculley, "Web-scale k-means clustering").
+ * The centers are fitted on random batches of rows: every row of a batch is
+ * assigned to its nearest center, and pulls it by 1/(rows the center got so far).
+ * Only the sample of rows the batches are drawn from has to be in memory,
+ * the labels of all the pixels are computed afterwards by Label().
+ **/
+class CMiniBatchKMeans
+{
+	public:
+		CMiniBatchKMeans(int nClusters, int nCols, int nBatchSize, int nIterations,
+			int nSeeding = KMEANS_SEED_PLUSPLUS);
+		virtual ~CMiniBatchKMeans();
+
+		/**
+		 * Fit the centers on random batches of the rows of pSamples
+		 * @param pSamples rows x nCols 32F matrix
+		 **/
+		void Fit(const CvMat * pSamples, CvRNG * pRng);
+
+		/**
+		 * The nearest center of each row of pRows, scaled by dScale
+		 * @param pRows rows x nCols 32F matrix
+		 * @param pLabels [out] a label per row
+		 **/
+		void Label(const CvMat * pRows, int * pLabels, double dScale = 1.0) const;
+
+		const float * GetCenter(int nCluster) const	{ return m_pCenters + nCluster*m_nCols; }
+
+	protected:
+
+		/**
+		 * Seed the centers with a short CKMeans run on one (larger) random batch
+		 **/
+		void Seed(const CvMat * pSamples, CvRNG * pRng);
+
+		int Nearest(const float * pRow, const float * pCenters) const;
+
+	protected:
+
+		int			m_nClusters;
+		int			m_nCols;
+		int			m_nBatchSize;
+		int			m_nIterations;
+		int			m_nSeeding;
+
+		float *		m_pCenters;
+
+		// The number of rows each center got so far
+		double *	m_pCounts;
+};
+
+/**
+ * A uniform random sample of the principal channels (reservoir sampling),
+ * and their largest absolute value, so the channels can be normalized
+ * the same way as when they are clustered as a whole
+ **/
+class CReservoirSink : public CFeatureSink
+{
+	public:
+		CReservoirSink(int nSize, CvRNG * pRng);
+		virtual ~CReservoirSink();
+
+		virtual void Put(CvRect tile, const CvMat * pRows);
+
+		/**
+		 * The sample, a view of the first min(size, rows seen) rows
+		 **/
+		CvMat * GetSamples(CvMat * pView);
+
+		double GetNorm() const	{ return m_dNorm; }
+
+	protected:
+		CvMat *		m_pSamples;
+		double		m_dSeen;
+		double		m_dNorm;
+		CvRNG *		m_pRng;
+};
+
+/**
+ * Labels the principal channels into a (pixels x 1) 32S matrix as they come
+ **/
+class CLabelSink : public CFeatureSink
+{
+	public:
+		CLabelSink(const CMiniBatchKMeans& kmeans, CvMat * pLabels, int nWidth, double dScale)
+			:m_kmeans(kmeans),m_pLabels(pLabels),m_nWidth(nWidth),m_dScale(dScale) {}
+
+		virtual void Put(CvRect tile, const CvMat * pRows);
+
+	protected:
+		const CMiniBatchKMeans&	m_kmeans;
+		CvMat *					m_pLabels;
+		int						m_nWidth;
+		double					m_dScale;
+
+		vector<int>				m_tileLabels;
+};
+
+#endif // __H_MINI_BATCH_KMEANS_H__
@@ -0,0 +1,263 @@
+#include "Superpixels.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CSuperpixels::CSuperpixels(IplImage * pImg, int nSize)
+:m_nWidth(pImg->width),m_nHeight(pImg->height),m_nSize(MAX(nSize, 4)),m_nCount(0)
+{
+	m_pLabels = new int[m_nWidth * m_nHeight];
+
+	Segment(pImg);
+	EnforceConnectivity();
+
+	m_pSums = new double[m_nCount * PRINCIPAL_CHANNEL_NUM];
+	m_pPixels = new int[m_nCount];
+	memset(m_pSums, 0, m_nCount * PRINCIPAL_CHANNEL_NUM * sizeof(double));
+	memset(m_pPixels, 0, m_nCount * sizeof(int));
+
+	for (int i=0;i<m_nWidth * m_nHeight;i++)
+		m_pPixels[m_pLabels[i]]++;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CSuperpixels::~CSuperpixels()
+{
+	delete [] m_pPixels;
+	delete [] m_pSums;
+	delete [] m_pLabels;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CSuperpixels::Segment(IplImage * pImg)
+{
+	int x, y, k, c;
+
+	IplImage * pLabImg = cvCreateImage(cvGetSize(pImg), IPL_DEPTH_8U, 3);
+	cvCvtColor(pImg, pLabImg, CV_BGR2Lab);
+
+	// The grid of the initial centers
+	double dStep = sqrt((double)m_nSize);
+	int nGridX = MAX(cvRound(m_nWidth / dStep), 1);
+	int nGridY = MAX(cvRound(m_nHeight / dStep), 1);
+	double dStepX = (double)m_nWidth / nGridX;
+	double dStepY = (double)m_nHeight / nGridY;
+	int nCenters = nGridX * nGridY;
+
+	// (L, a, b, x, y) of each center
+	float * pCenters = new float[nCenters * 5];
+	double * pSums = new double[nCenters * 5];
+	int * pCounts = new int[nCenters];
+
+	for (k=0;k<nCenters;k++)
+	{
+		x = MIN((int)(((k % nGridX) + 0.5) * dStepX), m_nWidth - 1);
+		y = MIN((int)(((k / nGridX) + 0.5) * dStepY), m_nHeight - 1);
+
+		// Move the seed to the lowest gradient of its 3x3 neighbourhood, off the edges
+		double dBest = DBL_MAX;
+		int nBestX = x, nBestY = y;
+		for (int ny=MAX(y-1, 1);ny<=MIN(y+1, m_nHeight-2);ny++)
+		{
+			for (int nx=MAX(x-1, 1);nx<=MIN(x+1, m_nWidth-2);nx++)
+			{
+				const uchar * pLeft = (uchar *)pLabImg->imageData + ny*pLabImg->widthStep + (nx-1)*3;
+				const uchar * pUp = (uchar *)pLabImg->imageData + (ny-1)*pLabImg->widthStep + nx*3;
+				double dGradient = 0;
+				for (c=0;c<3;c++) {
+					double dx = pLeft[6+c] - pLeft[c];
+					double dy = pUp[2*pLabImg->widthStep+c] - pUp[c];
+					dGradient += dx*dx + dy*dy;
+				}
+				if (dGradient < dBest) {
+					dBest = dGradient;
+					nBestX = nx;
+					nBestY = ny;
+				}
+			}
+		}
+
+		const uchar * pPixel = (uchar *)pLabImg->imageData + nBestY*pLabImg->widthStep + nBestX*3;
+		for (c=0;c<3;c++)
+			pCenters[k*5+c] = pPixel[c];
+		pCenters[k*5+3] = (float)nBestX;
+		pCenters[k*5+4] = (float)nBestY;
+	}
+
+	// D^2 = dLab^2 + (m/S)^2 * dxy^2
+	float fSpatialWeight = (float)(SUPERPIXEL_COMPACTNESS * SUPERPIXEL_COMPACTNESS / (dStep * dStep));
+
+	for (int nIter=0;nIter<SUPERPIXEL_ITERATIONS;nIter++)
+	{
+		// Each pixel picks the nearest of the centers of its grid cell and of the 8 around it
+#pragma omp parallel for schedule(static)
+		for (int py=0;py<m_nHeight;py++)
+		{
+			const uchar * pRow = (uchar *)pLabImg->imageData + py*pLabImg->widthStep;
+			int gy = MIN((int)(py / dStepY), nGridY - 1);
+
+			for (int px=0;px<m_nWidth;px++)
+			{
+				int gx = MIN((int)(px / dStepX), nGridX - 1);
+				float fBest = FLT_MAX;
+				int nBest = gy*nGridX + gx;
+
+				for (int ny=MAX(gy-1, 0);ny<=MIN(gy+1, nGridY-1);ny++)
+				{
+					for (int nx=MAX(gx-1, 0);nx<=MIN(gx+1, nGridX-1);nx++)
+					{
+						const float * pCenter = pCenters + (ny*nGridX + nx)*5;
+						float dl = pRow[px*3] - pCenter[0];
+						float da = pRow[px*3+1] - pCenter[1];
+						float db = pRow[px*3+2] - pCenter[2];
+						float dx = px - pCenter[3];
+						float dy = py - pCenter[4];
+						float fDist = dl*dl + da*da + db*db + fSpatialWeight*(dx*dx + dy*dy);
+						if (fDist < fBest) {
+							fBest = fDist;
+							nBest = ny*nGridX + nx;
+						}
+					}
+				}
+				m_pLabels[py*m_nWidth+px] = nBest;
+			}
+		}
+
+		// Move the centers to the means of their pixels
+		memset(pSums, 0, nCenters * 5 * sizeof(double));
+		memset(pCounts, 0, nCenters * sizeof(int));
+		for (y=0;y<m_nHeight;y++)
+		{
+			const uchar * pRow = (uchar *)pLabImg->imageData + y*pLabImg->widthStep;
+			for (x=0;x<m_nWidth;x++)
+			{
+				double * pSum = pSums + m_pLabels[y*m_nWidth+x]*5;
+				pSum[0] += pRow[x*3];
+				pSum[1] += pRow[x*3+1];
+				pSum[2] += pRow[x*3+2];
+				pSum[3] += x;
+				pSum[4] += y;
+				pCounts[m_pLabels[y*m_nWidth+x]]++;
+			}
+		}
+		for (k=0;k<nCenters;k++)
+		{
+			if (pCounts[k] == 0)
+				continue;
+			for (c=0;c<5;c++)
+				pCenters[k*5+c] = (float)(pSums[k*5+c] / pCounts[k]);
+		}
+	}
+
+	delete [] pCounts;
+	delete [] pSums;
+	delete [] pCenters;
+	cvReleaseImage(&pLabImg);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CSuperpixels::EnforceConnectivity()
+{
+	int nPixels = m_nWidth * m_nHeight;
+	int nMinSize = m_nSize / 4;
+	int * pNewLabels = new int[nPixels];
+	vector<int> component;
+	unsigned int j;
+
+	for (int i=0;i<nPixels;i++)
+		pNewLabels[i] = -1;
+
+	m_nCount = 0;
+	for (int i=0;i<nPixels;i++)
+	{
+		if (pNewLabels[i] >= 0)
+			continue;
+
+		int x = i % m_nWidth;
+		int y = i / m_nWidth;
+
+		// A relabeled neighbour, for the case this fragment is too small
+		int nAdjacent = -1;
+		if (x > 0 && pNewLabels[i-1] >= 0)
+			nAdjacent = pNewLabels[i-1];
+		else if (y > 0 && pNewLabels[i-m_nWidth] >= 0)
+			nAdjacent = pNewLabels[i-m_nWidth];
+
+		// The 4-connected fragment of the pixel, the vector is also the queue
+		component.clear();
+		component.push_back(i);
+		pNewLabels[i] = m_nCount;
+		for (j=0;j<component.size();j++)
+		{
+			int p = component[j];
+			int px = p % m_nWidth;
+			int py = p / m_nWidth;
+			int neighbours[4] = { px > 0 ? p-1 : -1, px < m_nWidth-1 ? p+1 : -1,
+				py > 0 ? p-m_nWidth : -1, py < m_nHeight-1 ? p+m_nWidth : -1 };
+
+			for (int n=0;n<4;n++)
+			{
+				int q = neighbours[n];
+				if (q >= 0 && pNewLabels[q] < 0 && m_pLabels[q] == m_pLabels[i]) {
+					pNewLabels[q] = m_nCount;
+					component.push_back(q);
+				}
+			}
+		}
+
+		if ((int)component.size() < nMinSize && nAdjacent >= 0) {
+			for (j=0;j<component.size();j++)
+				pNewLabels[component[j]] = nAdjacent;
+		}
+		else
+			m_nCount++;
+	}
+
+	memcpy(m_pLabels, pNewLabels, nPixels * sizeof(int));
+	delete [] pNewLabels;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CSuperpixels::Put(CvRect tile, const CvMat * pRows)
+{
+	for (int r=0;r<tile.height;r++)
+	{
+		for (int x=0;x<tile.width;x++)
+		{
+			const float * pRow = (const float *)(pRows->data.ptr + (r*tile.width + x)*pRows->step);
+			double * pSum = m_pSums + m_pLabels[(tile.y + r)*m_nWidth + tile.x + x]*PRINCIPAL_CHANNEL_NUM;
+			for (int c=0;c<PRINCIPAL_CHANNEL_NUM;c++)
+				pSum[c] += pRow[c];
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CSuperpixels::GetMeans(CvMat * pMeans)
+{
+	for (int k=0;k<m_nCount;k++)
+	{
+		float * pMean = (float *)(pMeans->data.ptr + k*pMeans->step);
+		for (int c=0;c<PRINCIPAL_CHANNEL_NUM;c++)
+			pMean[c] = (float)(m_pSums[k*PRINCIPAL_CHANNEL_NUM+c] / m_pPixels[k]);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CSuperpixels::Expand(const CvMat * pSuperpixelLabels, CvMat * pPixelLabels)
+{
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<m_nWidth * m_nHeight;i++)
+		pPixelLabels->data.i[i] = pSuperpixelLabels->data.i[m_pLabels[i]];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
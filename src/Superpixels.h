@@ -0,0 +1,79 @@
+#ifndef __H_SUPERPIXELS_H__
+#define __H_SUPERPIXELS_H__
+
+#include <cv.h>
+#include <vector>
+
+using std::vector;
+
+#include "fe/FeatureExtraction.h"
+
+// The weight of the spatial distance against the Lab distance, in Lab units per 
+// superpixel side (higher than the usual 10, the textures are noisy even blurred,
+// and break into fragments with less)
+#define SUPERPIXEL_COMPACTNESS	20
+#define SUPERPIXEL_ITERATIONS	10
+
+/**
+ * SLIC superpixels (Achanta et al., "SLIC superpixels compared to state-of-the-art
+ * superpixel methods"): k-means in (L, a, b, x, y) from centers on a regular grid,
+ * where each pixel only considers the centers of the nearby grid cells.
+ * The superpixels are then made connected, by merging the fragments smaller
+ * than a quarter of a superpixel into an adjacent one.
+ *
+ * As a CFeatureSink, it accumulates the principal channels of each superpixel,
+ * so the superpixels can be clustered by their mean features instead of the pixels.
+ **/
+class CSuperpixels : public CFeatureSink
+{
+	public:
+		/**
+		 * @param pImg 8 bit BGR image
+		 * @param nSize the requested number of pixels of a superpixel
+		 **/
+		CSuperpixels(IplImage * pImg, int nSize);
+		virtual ~CSuperpixels();
+
+		int GetCount() const			{ return m_nCount; }
+
+		/**
+		 * The superpixel of each pixel, in raster order
+		 **/
+		const int * GetLabels() const	{ return m_pLabels; }
+
+		virtual void Put(CvRect tile, const CvMat * pRows);
+
+		/**
+		 * The mean principal channels of each superpixel, after all the pixels were Put
+		 * @param pMeans [out] count x PRINCIPAL_CHANNEL_NUM 32F matrix
+		 **/
+		void GetMeans(CvMat * pMeans);
+
+		/**
+		 * Give each pixel the label of its superpixel
+		 * @param pSuperpixelLabels count x 1 32S matrix
+		 * @param pPixelLabels [out] pixels x 1 32S matrix
+		 **/
+		void Expand(const CvMat * pSuperpixelLabels, CvMat * pPixelLabels);
+
+	protected:
+
+		void Segment(IplImage * pImg);
+
+		void EnforceConnectivity();
+
+	protected:
+
+		int			m_nWidth;
+		int			m_nHeight;
+		int			m_nSize;
+		int			m_nCount;
+
+		int *		m_pLabels;
+
+		// The sums of the principal channels, and the pixels, of each superpixel
+		double *	m_pSums;
+		int *		m_pPixels;
+};
+
+#endif // __H_SUPERPIXELS_H__
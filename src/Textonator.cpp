@@ -1,9 +1,17 @@
 #include "Textonator.h"
+#include "MiniBatchKMeans.h"
+#include "fe/FeatureCache.h"
 #include "ColorUtils.h"
 #include "defs.h"
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TEXTONATOR_SSE2
+#endif
+
 Textonator::Textonator(IplImage * Img, int nClusters, int nMinTextonSize, CvScalar& backgroundPixel):
-m_pImg(Img),m_nClusters(nClusters),m_nMinTextonSize(nMinTextonSize),m_backgroundPixel(backgroundPixel)
+m_pImg(Img),m_nClusters(nClusters),m_nMinTextonSize(nMinTextonSize),m_backgroundPixel(backgroundPixel),
+m_pLabeler(NULL),m_strFeatureCacheDir(NULL)
 {
 	m_pOutImg = cvCreateImage(cvSize(m_pImg->width,m_pImg->height),
 								m_pImg->depth,
@@ -33,6 +41,7 @@ Textonator::~Textonator()
 	cvReleaseMat(&m_pClusters);
 	cvReleaseImage(&m_pOutImg);
 	cvReleaseImage(&m_pSegmentBoundaries);
+	delete m_pLabeler;
 }
 
 void Textonator::blurImage()
@@ -59,23 +68,36 @@ void Textonator::unifyTextonMaps(vector<int*> & pTextonMapList)
 
 void Textonator::textonize(vector<Cluster>& clusterList)
 {
-	vector<int*> pTextonMapList;
-
-	//blur the edge, to remove insignificant edges
-	blurImage();
-
 	//we'll start by segmenting and clustering the image
 	segment();
 
+	textonizeClusters(clusterList);
+}
+
+void Textonator::textonizeClusters(vector<Cluster>& clusterList)
+{
+	vector<int*> pTextonMapList;
+
 	printf("<<< Texton Extraction >>>\n");
+
+	//the edges of all the clusters at once, instead of coloring each cluster for its own edges
+	if (m_textonParams.nEdges == TEXTON_EDGES_SHARED)
+		sharedEdgeDetect();
+
+	//the components of all the clusters at once, instead of a flood fill per cluster
+	if (m_textonParams.nLabeling == TEXTON_LABELING_UNIONFIND)
+		labelComponents();
+
 	for (int i = 0;i < m_nClusters; i++) {
 		int * pTextonMap = new int[m_pOutImg->height * m_pOutImg->width];
 
-		//color the cluster we are currently working on
-		colorCluster(i);
+		if (m_textonParams.nLabeling == TEXTON_LABELING_FLOOD && m_textonParams.nEdges == TEXTON_EDGES_CLUSTER) {
+			//color the cluster we are currently working on
+			colorCluster(i);
 
-		//retrieve the canny edges of the cluster
-		cannyEdgeDetect();
+			//retrieve the canny edges of the cluster
+			cannyEdgeDetect();
+		}
 
 		//Extract the textons from the cluster 
 		//according to the collected boundaries
@@ -93,30 +115,264 @@ void Textonator::segment()
 {
   printf("\n<<< Feature Extraction >>>\n");
 
-  CFeatureExtraction *pFeatureExtractor = new CFeatureExtraction(m_pSmoothImg);
+  //blur the edge, to remove insignificant edges
+  //(the superpixels are computed on the blurred image, even when the features are cached)
+  blurImage();
+
+  //the features depend only on the image and the feature parameters,
+  //so they may have been computed by a previous run
+  CFeatureCache * pCache = NULL;
+  ULONGLONG key = 0;
+  if (m_strFeatureCacheDir != NULL) {
+	  pCache = new CFeatureCache(m_strFeatureCacheDir);
+	  key = CFeatureCache::GetKey(m_pImg, m_featureParams);
+
+	  CvMat * pCachedChannels = pCache->Load(key);
+	  if (pCachedChannels != NULL) {
+		  printf("* Principal channels were loaded from the feature cache\n");
+		  cluster(pCachedChannels);
+		  delete pCache;
+		  return;
+	  }
+  }
+
+  CFeatureExtraction *pFeatureExtractor = new CFeatureExtraction(m_pSmoothImg, m_featureParams);
+
+  //the tiled extraction can stream its tiles into the mini-batch k-means
+  //or into the superpixels, there is nothing to cache then
+  //(the sweep needs all the channels, unless it clusters superpixels)
+  bool fStreamPixels = (m_clusterParams.nAlgorithm == KMEANS_MINIBATCH && m_clusterParams.nSweepMin == 0);
+  if ((fStreamPixels || m_clusterParams.nSuperpixelSize > 0) && pFeatureExtractor->IsTiled()) {
+	  clusterStreaming(pFeatureExtractor);
+	  delete pFeatureExtractor;
+	  delete pCache;
+	  return;
+  }
+
   pFeatureExtractor->run();
 
-  cluster(pFeatureExtractor);
+  if (pCache != NULL && !pCache->Save(key, pFeatureExtractor->GetPrincipalChannels()))
+	  printf("* The principal channels could not be saved to the feature cache\n");
+
+  cluster(pFeatureExtractor->GetPrincipalChannels());
 
   delete pFeatureExtractor;
+  delete pCache;
 }
 
-void Textonator::cluster(CFeatureExtraction *pFeatureExtractor) 
+void Textonator::cluster(CvMat * pPrincipalChannels) 
 {
-  CvMat * pChannels = 
-	  cvCreateMat(pFeatureExtractor->GetPrincipalChannels()->rows,
-					pFeatureExtractor->GetPrincipalChannels()->cols,
-					pFeatureExtractor->GetPrincipalChannels()->type);
+  if (m_clusterParams.nSuperpixelSize > 0) {
+	  CSuperpixels superpixels(m_pSmoothImg, m_clusterParams.nSuperpixelSize);
+	  superpixels.Put(cvRect(0, 0, m_pImg->width, m_pImg->height), pPrincipalChannels);
+	  clusterSuperpixels(&superpixels);
+	  return;
+  }
 
+  clusterRows(pPrincipalChannels, m_pClusters);
+}
+
+void Textonator::clusterRows(CvMat * pRows, CvMat * pLabels) 
+{
   //normalize the principal channels
-  double c_norm = cvNorm(pFeatureExtractor->GetPrincipalChannels(), 0, CV_C, 0);
-  cvConvertScale(pFeatureExtractor->GetPrincipalChannels(), pChannels, 1/c_norm);
+  double c_norm = cvNorm(pRows, 0, CV_C, 0);
+  double dScale = 1/c_norm;
+
+  //the compact storage modes pack the rows with the scale, only the float
+  //modes (and the mini-batch k-means) need a normalized float copy
+  bool fCompact = m_clusterParams.nStorage != FEATURE_STORAGE_FLOAT &&
+	  (m_clusterParams.nSweepMin > 0 || m_clusterParams.nAlgorithm != KMEANS_MINIBATCH);
+
+  CvMat * pChannels = pRows;
+  if (!fCompact) {
+	  pChannels = cvCreateMat(pRows->rows,
+					pRows->cols,
+					pRows->type);
+	  cvConvertScale(pRows, pChannels, dScale);
+	  dScale = 1;
+  }
+
+  CvTermCriteria criteria = cvTermCriteria( CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 100, 0.001 );
 
   //perform k0means on the normalized channels
-  cvKMeans2(pChannels, m_nClusters, m_pClusters,  
-	  cvTermCriteria( CV_TERMCRIT_EPS+CV_TERMCRIT_ITER, 100, 0.001 ));
+  if (m_clusterParams.nSweepMin > 0)
+	  clusterSweep(pChannels, dScale, criteria, pLabels);
+  else if (m_clusterParams.nAlgorithm == KMEANS_MINIBATCH)
+	  clusterMiniBatch(pChannels, pLabels);
+  else if (m_clusterParams.nStorage == FEATURE_STORAGE_FLOAT && m_clusterParams.nAlgorithm == KMEANS_CV)
+	  cvKMeans2(pChannels, m_nClusters, pLabels, criteria);
+  else
+	  clusterKMeans(pChannels, dScale, criteria, pLabels);
     
-  cvReleaseMat(&pChannels);
+  if (pChannels != pRows)
+	  cvReleaseMat(&pChannels);
+}
+
+void Textonator::clusterSuperpixels(CSuperpixels * pSuperpixels)
+{
+  int nCount = pSuperpixels->GetCount();
+  CvMat * pMeans = cvCreateMat(nCount, PRINCIPAL_CHANNEL_NUM, CV_32F);
+  CvMat * pLabels = cvCreateMat(nCount, 1, CV_32SC1);
+
+  pSuperpixels->GetMeans(pMeans);
+  clusterRows(pMeans, pLabels);
+  pSuperpixels->Expand(pLabels, m_pClusters);
+
+  printf("* Clustered %d superpixels (%.1f pixels each)\n", 
+	  nCount, (double)m_pImg->width * m_pImg->height / nCount);
+
+  cvReleaseMat(&pLabels);
+  cvReleaseMat(&pMeans);
+}
+
+void Textonator::clusterKMeans(CvMat * pChannels, double dScale, CvTermCriteria criteria, CvMat * pLabels)
+{
+  CvRNG rng = cvRNG(-1);
+  int nIter;
+
+  //the compact storage modes can not use cvKMeans2
+  int nAlgorithm = m_clusterParams.nAlgorithm;
+  if (nAlgorithm == KMEANS_CV)
+	  nAlgorithm = KMEANS_LLOYD;
+
+  if (m_clusterParams.nStorage == FEATURE_STORAGE_HALF) {
+	  CHalfFeatures features(pChannels, dScale);
+	  CKMeans<CHalfFeatures> kmeans(features, m_nClusters, nAlgorithm, m_clusterParams.nSeeding);
+	  nIter = kmeans.Run(pLabels, criteria, &rng);
+  }
+  else if (m_clusterParams.nStorage == FEATURE_STORAGE_BYTE) {
+	  CByteFeatures features(pChannels, dScale);
+	  CKMeans<CByteFeatures> kmeans(features, m_nClusters, nAlgorithm, m_clusterParams.nSeeding);
+	  nIter = kmeans.Run(pLabels, criteria, &rng);
+  }
+  else {
+	  CFloatFeatures features(pChannels);
+	  CKMeans<CFloatFeatures> kmeans(features, m_nClusters, nAlgorithm, m_clusterParams.nSeeding);
+	  nIter = kmeans.Run(pLabels, criteria, &rng);
+  }
+
+  printf("* k-means (%s) on %s channels: %d iterations\n", 
+	  nAlgorithm == KMEANS_HAMERLY ? "Hamerly" : "Lloyd",
+	  m_clusterParams.nStorage == FEATURE_STORAGE_HALF ? "half precision" : 
+	  (m_clusterParams.nStorage == FEATURE_STORAGE_BYTE ? "8 bit" : "float"), nIter);
+}
+
+void Textonator::clusterSweep(CvMat * pChannels, double dScale, CvTermCriteria criteria, CvMat * pLabels)
+{
+  //the warm start needs CKMeans
+  int nAlgorithm = m_clusterParams.nAlgorithm;
+  if (nAlgorithm == KMEANS_CV || nAlgorithm == KMEANS_MINIBATCH)
+	  nAlgorithm = KMEANS_HAMERLY;
+
+  if (m_clusterParams.nStorage == FEATURE_STORAGE_HALF) {
+	  CHalfFeatures features(pChannels, dScale);
+	  sweepKMeans(features, nAlgorithm, criteria, pLabels);
+  }
+  else if (m_clusterParams.nStorage == FEATURE_STORAGE_BYTE) {
+	  CByteFeatures features(pChannels, dScale);
+	  sweepKMeans(features, nAlgorithm, criteria, pLabels);
+  }
+  else {
+	  CFloatFeatures features(pChannels);
+	  sweepKMeans(features, nAlgorithm, criteria, pLabels);
+  }
+}
+
+template <class TFeatures>
+void Textonator::sweepKMeans(const TFeatures& features, int nAlgorithm, CvTermCriteria criteria, CvMat * pLabels)
+{
+  CvRNG rng = cvRNG(-1);
+  int nMin = MAX(m_clusterParams.nSweepMin, 1);
+  int nMax = MAX(m_clusterParams.nSweepMax, nMin);
+  int nCols = features.GetCols();
+
+  CvMat * pSweepLabels = cvCreateMat(pLabels->rows, 1, CV_32SC1);
+  float * pCenters = new float[nMax * nCols];
+  double dBestScore = -1;
+  int nBest = nMin;
+
+  printf("* Cluster count sweep, %d to %d clusters:\n", nMin, nMax);
+  for (int k = nMin; k <= nMax; k++) {
+	  DWORD time1 = GetTickCount();
+
+	  //the centers of k-1 clusters, and one more drawn by the seeding
+	  CKMeans<TFeatures> kmeans(features, k, nAlgorithm, m_clusterParams.nSeeding);
+	  if (k > nMin)
+		  kmeans.SetInitialCenters(pCenters, k - 1);
+	  int nIter = kmeans.Run(pSweepLabels, criteria, &rng);
+	  double dScore = kmeans.GetScore(pSweepLabels);
+
+	  for (int i = 0; i < k; i++)
+		  memcpy(pCenters + i*nCols, kmeans.GetCenter(i), nCols*sizeof(float));
+
+	  DWORD time2 = GetTickCount();
+	  printf("\tk=%d: Calinski-Harabasz score=%.2f, %d iterations, %ld ms\n", 
+		  k, dScore, nIter, time2 - time1);
+
+	  //a single cluster has no score, it is only kept if it is the only one
+	  if (dScore > dBestScore) {
+		  dBestScore = dScore;
+		  nBest = k;
+		  cvCopy(pSweepLabels, pLabels);
+	  }
+  }
+
+  printf("* Best cluster count: %d\n", nBest);
+  m_nClusters = nBest;
+
+  delete [] pCenters;
+  cvReleaseMat(&pSweepLabels);
+}
+
+void Textonator::clusterMiniBatch(CvMat * pChannels, CvMat * pLabels)
+{
+  CvRNG rng = cvRNG(-1);
+
+  CMiniBatchKMeans kmeans(m_nClusters, pChannels->cols, 
+	  m_clusterParams.nBatchSize, m_clusterParams.nBatchIterations, m_clusterParams.nSeeding);
+  kmeans.Fit(pChannels, &rng);
+  kmeans.Label(pChannels, pLabels->data.i);
+
+  printf("* Mini-batch k-means: %d batches of %d rows\n", 
+	  m_clusterParams.nBatchIterations, m_clusterParams.nBatchSize);
+}
+
+void Textonator::clusterStreaming(CFeatureExtraction * pFeatureExtractor)
+{
+  CvRNG rng = cvRNG(-1);
+
+  //a single pass accumulates the principal channels of the superpixels
+  if (m_clusterParams.nSuperpixelSize > 0) {
+	  CSuperpixels superpixels(m_pSmoothImg, m_clusterParams.nSuperpixelSize);
+	  pFeatureExtractor->run(&superpixels);
+	  printf(">>> Feature Extraction phase completed successfully! <<<\n\n");
+	  clusterSuperpixels(&superpixels);
+	  return;
+  }
+
+  //first pass, a sample of the principal channels and their norm
+  int nSampleSize = (int)MIN((double)m_clusterParams.nBatchSize * m_clusterParams.nBatchIterations, 
+	  (double)m_pImg->width * m_pImg->height);
+  CReservoirSink reservoir(nSampleSize, &rng);
+  pFeatureExtractor->run(&reservoir);
+
+  //normalize the sample the same way as the whole channels
+  double c_norm = reservoir.GetNorm();
+  CvMat samples;
+  reservoir.GetSamples(&samples);
+  cvConvertScale(&samples, &samples, 1/c_norm);
+
+  CMiniBatchKMeans kmeans(m_nClusters, PRINCIPAL_CHANNEL_NUM, 
+	  m_clusterParams.nBatchSize, m_clusterParams.nBatchIterations, m_clusterParams.nSeeding);
+  kmeans.Fit(&samples, &rng);
+
+  //second pass, every pixel is labeled as its tile is computed
+  CLabelSink labels(kmeans, m_pClusters, m_pImg->width, 1/c_norm);
+  pFeatureExtractor->run(&labels);
+
+  printf(">>> Feature Extraction phase completed successfully! <<<\n\n");
+  printf("* Mini-batch k-means: %d batches of %d rows, drawn from %d sampled pixels\n", 
+	  m_clusterParams.nBatchIterations, m_clusterParams.nBatchSize, nSampleSize);
 }
 
 void Textonator::colorCluster(int nCluster)
@@ -147,52 +403,104 @@ void Textonator::cannyEdgeDetect()
     cvReleaseImage(&bn);
 }
 
+void Textonator::sharedEdgeDetect()
+{
+	int nWidth = m_pImg->width;
+	int nHeight = m_pImg->height;
+	const int * pClusters = m_pClusters->data.i;
+
+	//the texture edges of the blurred image
+	IplImage * bn = cvCreateImage(cvGetSize(m_pSmoothImg), IPL_DEPTH_8U, 1);
+	cvCvtColor(m_pSmoothImg, bn, CV_BGR2GRAY);
+	cvCanny(bn, m_pSegmentBoundaries, 70, 90);
+	cvReleaseImage(&bn);
+
+	//and the cluster boundaries, the pixels with a 4-neighbor in another cluster
+	for (int y = 0; y < nHeight; y++) {
+		uchar * pBorderRow = (uchar *)m_pSegmentBoundaries->imageData + y*m_pSegmentBoundaries->widthStep;
+		const int * pRow = pClusters + y*nWidth;
+
+		for (int x = 0; x < nWidth; x++) {
+			int nCluster = pRow[x];
+			if ((x > 0 && pRow[x - 1] != nCluster) ||
+				(x < nWidth - 1 && pRow[x + 1] != nCluster) ||
+				(y > 0 && pRow[x - nWidth] != nCluster) ||
+				(y < nHeight - 1 && pRow[x + nWidth] != nCluster))
+				pBorderRow[x] = EDGE_DATA;
+		}
+	}
+}
+
 void Textonator::assignTextons(int x, 
 							   int y, 
-							   uchar * pData, 
 							   int * pTextonMap, 
 							   int nTexton)
 {
-	//if we are in no man's land or if we are already coloured
-	if (pTextonMap[y*m_pImg->width+x] == OUT_OF_SEGMENT_DATA
-		|| pTextonMap[y*m_pImg->width+x] >= FIRST_TEXTON_NUM)
-		return;
+	int nWidth = m_pImg->width;
+	int nHeight = m_pImg->height;
 
-	m_nCurTextonSize++;
+	m_fillStack.clear();
+	m_fillStack.push_back(cvPoint(x, y));
+	m_textonPixels.clear();
 
-	//if we are on a border, color it and return
-	if (pTextonMap[y*m_pImg->width+x] == BORDER_DATA) {
-		pTextonMap[y*m_pImg->width+x] = nTexton;
-		return;
-	}
+	while (!m_fillStack.empty()) {
+		CvPoint seed = m_fillStack.back();
+		m_fillStack.pop_back();
 
-	//color the pixel with the current 
-	pTextonMap[y*m_pImg->width+x] = nTexton;
+		int * pRow = pTextonMap + seed.y*nWidth;
 
-	//spread to the 4-connected neighbors (if possible)
-	if ((x < (m_pImg->width - 1)) && 
-		(pTextonMap[y*m_pImg->width+x + 1] == UNCLUSTERED_DATA || 
-		 pTextonMap[y*m_pImg->width+x + 1] == BORDER_DATA))
-	{
-		assignTextons(x+1,y,pData,pTextonMap,nTexton);
-	}
-	if ((x >= 1) && 
-		(pTextonMap[y*m_pImg->width+x - 1] == UNCLUSTERED_DATA || 
-		 pTextonMap[y*m_pImg->width+x - 1] == BORDER_DATA)) 
-	{
-		assignTextons(x-1,y,pData,pTextonMap,nTexton);
-	}
-	if ((y < (m_pImg->height - 1)) && 
-		(pTextonMap[(y + 1)*m_pImg->width+x] == UNCLUSTERED_DATA || 
-		pTextonMap[(y + 1)*m_pImg->width+x] == BORDER_DATA)) 
-	{
-		assignTextons(x,y+1,pData,pTextonMap,nTexton);
-	}
-	if ((y >= 1) && 
-		(pTextonMap[(y - 1)*m_pImg->width+x] == UNCLUSTERED_DATA || 
-		 pTextonMap[(y - 1)*m_pImg->width+x] == BORDER_DATA))
-	{
-		assignTextons(x,y-1,pData,pTextonMap,nTexton);
+		//the run may have been filled since it was pushed
+		if (pRow[seed.x] != UNCLUSTERED_DATA)
+			continue;
+
+		//the run of unclustered pixels around the seed
+		int nLeft = seed.x, nRight = seed.x;
+		while (nLeft > 0 && pRow[nLeft - 1] == UNCLUSTERED_DATA)
+			nLeft--;
+		while (nRight < nWidth - 1 && pRow[nRight + 1] == UNCLUSTERED_DATA)
+			nRight++;
+
+		for (int i = nLeft; i <= nRight; i++) {
+			pRow[i] = nTexton;
+			m_textonPixels.push_back(seed.y*nWidth + i);
+		}
+		m_nCurTextonSize += nRight - nLeft + 1;
+
+		//borders are colored, but do not spread
+		if (nLeft > 0 && pRow[nLeft - 1] == BORDER_DATA) {
+			pRow[nLeft - 1] = nTexton;
+			m_textonPixels.push_back(seed.y*nWidth + nLeft - 1);
+			m_nCurTextonSize++;
+		}
+		if (nRight < nWidth - 1 && pRow[nRight + 1] == BORDER_DATA) {
+			pRow[nRight + 1] = nTexton;
+			m_textonPixels.push_back(seed.y*nWidth + nRight + 1);
+			m_nCurTextonSize++;
+		}
+
+		//a seed for each run of unclustered pixels above and below the run
+		for (int ny = seed.y - 1; ny <= seed.y + 1; ny += 2) {
+			if (ny < 0 || ny >= nHeight)
+				continue;
+
+			int * pNextRow = pTextonMap + ny*nWidth;
+			bool fInRun = false;
+			for (int i = nLeft; i <= nRight; i++) {
+				if (pNextRow[i] == UNCLUSTERED_DATA) {
+					if (!fInRun)
+						m_fillStack.push_back(cvPoint(i, ny));
+					fInRun = true;
+				}
+				else {
+					if (pNextRow[i] == BORDER_DATA) {
+						pNextRow[i] = nTexton;
+						m_textonPixels.push_back(ny*nWidth + i);
+						m_nCurTextonSize++;
+					}
+					fInRun = false;
+				}
+			}
+		}
 	}
 }
 
@@ -216,7 +524,6 @@ void Textonator::colorTextonMap(uchar *pBorderData, int * pTextonMap, int nClust
 
 int Textonator::scanForTextons(int nCluster, bool &fBackgroundCluster, int * pTextonMap)
 {
-	uchar * pData  = (uchar *) m_pOutImg->imageData;
 	uchar * pBorderData  = (uchar *) m_pSegmentBoundaries->imageData;
 
 	// Create a texton map with the values:
@@ -245,7 +552,7 @@ int Textonator::scanForTextons(int nCluster, bool &fBackgroundCluster, int * pTe
 
 				m_nCurTextonSize = 0;
 
-				assignTextons(i,j, pData, pTextonMap, nTexton);
+				assignTextons(i,j, pTextonMap, nTexton);
 				
 				//if (fBackgroundCluster)
 				//	continue;
@@ -258,14 +565,9 @@ int Textonator::scanForTextons(int nCluster, bool &fBackgroundCluster, int * pTe
 				}
 				else
 				{
-					//return the colored pixel to the pixel pool
-					for (int i=0; i < m_pOutImg->width; i++){
-						for (int j=0; j < m_pOutImg->height; j++) {
-							if (pTextonMap[j * m_pOutImg->width + i] == nTexton) {
-								pTextonMap[j * m_pOutImg->width + i] = UNCLUSTERED_DATA;
-							}
-						}
-					}
+					//return the colored pixels to the pixel pool
+					for (unsigned int p = 0; p < m_textonPixels.size(); p++)
+						pTextonMap[m_textonPixels[p]] = UNCLUSTERED_DATA;
 				}
 			}
 		} 
@@ -277,15 +579,95 @@ int Textonator::scanForTextons(int nCluster, bool &fBackgroundCluster, int * pTe
 	return (nTexton - FIRST_TEXTON_NUM);
 }
 
+void Textonator::labelComponents()
+{
+	int nWidth = m_pOutImg->width;
+	int nHeight = m_pOutImg->height;
+	IplImage * pEdges = m_pSegmentBoundaries;
+
+	//the edges of each pixel are the ones of its own cluster (the shared edges are already there)
+	if (m_textonParams.nEdges == TEXTON_EDGES_CLUSTER) {
+		pEdges = cvCreateImage(cvGetSize(m_pOutImg), IPL_DEPTH_8U, 1);
+
+		for (int i = 0; i < m_nClusters; i++) {
+			colorCluster(i);
+			cannyEdgeDetect();
+
+			for (int y = 0; y < nHeight; y++) {
+				uchar * pEdgeRow = (uchar *)pEdges->imageData + y*pEdges->widthStep;
+				uchar * pBorderRow = (uchar *)m_pSegmentBoundaries->imageData + y*m_pSegmentBoundaries->widthStep;
+				for (int x = 0; x < nWidth; x++) {
+					if (m_pClusters->data.i[y*nWidth + x] == i)
+						pEdgeRow[x] = (pBorderRow[x] == EDGE_DATA) ? EDGE_DATA : 0;
+				}
+			}
+		}
+	}
+
+	DWORD time1 = GetTickCount();
+	delete m_pLabeler;
+	m_pLabeler = new CComponentLabeler(nWidth, nHeight);
+	int nComponents = m_pLabeler->Label(m_pClusters->data.i, (uchar *)pEdges->imageData, pEdges->widthStep);
+	m_pLabeler->AttachEdges(m_pClusters->data.i, (uchar *)pEdges->imageData, pEdges->widthStep);
+	printf("* Labeled %d components of %d clusters in %ld ms\n", 
+		nComponents, m_nClusters, GetTickCount() - time1);
+
+	if (pEdges != m_pSegmentBoundaries)
+		cvReleaseImage(&pEdges);
+}
+
+int Textonator::scanComponents(int nCluster, bool &fBackgroundCluster, int * pTextonMap)
+{
+	int nSize = m_pOutImg->width * m_pOutImg->height;
+	const int * pLabels = m_pLabeler->GetLabels();
+	const vector<SComponent>& components = m_pLabeler->GetComponents();
+
+	//the texton of each large enough component of the cluster, UNCLUSTERED_DATA for the others
+	vector<int> textons(components.size(), UNCLUSTERED_DATA);
+	int nTexton = FIRST_TEXTON_NUM;
+	for (unsigned int c = 0; c < components.size(); c++) {
+		if (components[c].nClass == nCluster && components[c].nArea > m_nMinTextonSize)
+			textons[c] = nTexton++;
+	}
+
+	for (int i = 0; i < nSize; i++) {
+		if (m_pClusters->data.i[i] != nCluster)
+			pTextonMap[i] = OUT_OF_SEGMENT_DATA;
+		else if (pLabels[i] < 0)
+			pTextonMap[i] = BORDER_DATA;
+		else
+			pTextonMap[i] = textons[pLabels[i]];
+	}
+
+	//Check if its a background cluster
+	if (m_backgroundPixel.val[0] != UNDEFINED && 
+		m_backgroundPixel.val[1] != UNDEFINED){
+		int pos = (int)m_backgroundPixel.val[1]*m_pOutImg->width+(int)m_backgroundPixel.val[0];
+		if (m_pClusters->data.i[pos] == nCluster)
+			fBackgroundCluster = true;
+	}
+
+	return (nTexton - FIRST_TEXTON_NUM);
+}
+
+static inline void addToBox(SComponent& box, int x, int y)
+{
+	if (box.nMinX > x) box.nMinX = x;
+	if (box.nMinY > y) box.nMinY = y;
+	if (box.nMaxX < x) box.nMaxX = x;
+	if (box.nMaxY < y) box.nMaxY = y;
+	box.nArea++;
+}
+
 void Textonator::retrieveTextons(int nClusterSize, 
 								 int nCluster, 
 								 bool fBackgroundCluster,
 								 int * pTextonMap, 
 								 vector<Cluster>& clusterList)
 {
-	uchar * pData  = (uchar *) m_pOutImg->imageData;
-	bool firstBackgroundTexton = fBackgroundCluster;
-	int nCurTexton = FIRST_TEXTON_NUM;
+	int nWidth = m_pOutImg->width;
+	int nHeight = m_pOutImg->height;
+	int nTextons = nClusterSize;
 	list<Texton*> curTextonList;
 
 	//create the new cluster
@@ -295,49 +677,36 @@ void Textonator::retrieveTextons(int nClusterSize,
 	if (fBackgroundCluster)
 		nClusterSize++;
 
-	for (int nNum = 0; nNum < nClusterSize; nNum++){
-
-		//"Replenish" the original image
-		memcpy(pData, (uchar *)m_pImg->imageData, m_pImg->imageSize);
-
-		int minX = m_pImg->width;
-		int minY = m_pImg->height;
-		int maxX = 0;
-		int maxY = 0;
+	//the bounding box and pixel count of every texton, and of all of them together, in one pass
+	SComponent emptyBox = { nCluster, 0, nWidth, nHeight, 0, 0, 0, 0 };
+	vector<SComponent> boxes(nTextons + 1, emptyBox);
+	for (int j = 0; j < nHeight; j++) {
+		for (int i = 0; i < nWidth; i++) {
+			int nTexton = pTextonMap[j * nWidth + i] - FIRST_TEXTON_NUM;
+			if (nTexton < 0)
+				continue;
 
-		int nCount = 0;
-		//figure out the texton dimensions
-		for (int i = 0; i < m_pOutImg->width; i++){
-			for (int j = 0; j < m_pOutImg->height; j++) {
-				bool fCheck;
-				if (firstBackgroundTexton)
-					fCheck = pTextonMap[j * m_pOutImg->width + i] >= FIRST_TEXTON_NUM;
-				else
-					fCheck = pTextonMap[j * m_pOutImg->width + i] == nCurTexton;
+			if (nTexton < nTextons)
+				addToBox(boxes[nTexton], i, j);
+			addToBox(boxes[nTextons], i, j);
+		}
+	}
 
-				if (fCheck)
-				{
-					if (minX > i) minX = i;
-					if (minY > j) minY = j;
-					if (maxX < i) maxX = i;
-					if (maxY < j) maxY = j;
+	bool firstBackgroundTexton = fBackgroundCluster;
+	int nCurTexton = FIRST_TEXTON_NUM;
+	for (int nNum = 0; nNum < nClusterSize; nNum++){
 
-					nCount++;
-				}
-				else {
-					ColorUtils::recolorPixel(pData, j, i, m_pOutImg->widthStep, &m_bgColor);
-				}
-			}
-		}
+		//the background texton is all the textons of the cluster
+		int nTexton = firstBackgroundTexton ? UNDEFINED : nCurTexton;
+		const SComponent& box = (nTexton == UNDEFINED) ? boxes[nTextons] : boxes[nTexton - FIRST_TEXTON_NUM];
 
 		if (firstBackgroundTexton)
 			firstBackgroundTexton = false;
 		else
 			nCurTexton++;
 
-		
 		// Create bounding box with the size of the texton
-		SBox boundingBox(minX, minY, maxX, maxY);
+		SBox boundingBox(box.nMinX, box.nMinY, box.nMaxX, box.nMaxY);
 
 		int xSize = boundingBox.getWidth();
 		int ySize = boundingBox.getHeight();
@@ -348,7 +717,7 @@ void Textonator::retrieveTextons(int nClusterSize,
 											m_pImg->depth,
 											m_pImg->nChannels);
 		
-		extractTexton(boundingBox, pData, pTexton);
+		extractTexton(boundingBox, pTextonMap, nTexton, pTexton);
 
 		Texton* t = new Texton(pTexton, 
 								nCluster, 
@@ -377,85 +746,139 @@ void Textonator::extractTexton(int minX,
 							   int maxX, 
 							   int minY, 
 							   int maxY, 
-							   uchar * pImageData, 
+							   int * pTextonMap, 
+							   int nTexton, 
 							   IplImage* pTexton)
 {
-	CvScalar color;
-	int step = m_pOutImg->widthStep;
+	int step = m_pImg->widthStep;
+	uchar * pImageData = (uchar *)m_pImg->imageData;
 	uchar * pImData  = (uchar *)pTexton->imageData;
 
-	for (int i = minX; i < maxX; i++)
+	for (int j = minY; j < maxY; j++) 
 	{
-		for (int j = minY; j < maxY; j++) 
+		const int * pTextonRow = pTextonMap + j * m_pImg->width;
+		for (int i = minX; i < maxX; i++)
 		{
-			color.val[0] = pImageData[j*step+i*3+0];
-			color.val[1] = pImageData[j*step+i*3+1];
-			color.val[2] = pImageData[j*step+i*3+2];
-
-			ColorUtils::recolorPixel(pImData, j - minY, i - minX, pTexton->widthStep, &color);
+			bool fInTexton = (nTexton == UNDEFINED) ? 
+				pTextonRow[i] >= FIRST_TEXTON_NUM : pTextonRow[i] == nTexton;
+
+			if (fInTexton) {
+				uchar * pDst = pImData + (j - minY)*pTexton->widthStep + (i - minX)*3;
+				pDst[0] = pImageData[j*step+i*3+0];
+				pDst[1] = pImageData[j*step+i*3+1];
+				pDst[2] = pImageData[j*step+i*3+2];
+			}
+			else
+				ColorUtils::recolorPixel(pImData, j - minY, i - minX, pTexton->widthStep, &m_bgColor);
 		}
 	}
 }
 
 void Textonator::extractTexton(SBox& boundingBox, 
-							   uchar * pImageData, 
+							   int * pTextonMap, 
+							   int nTexton, 
 							   IplImage* pTexton)
 {
 	extractTexton(boundingBox.minX, 
 					boundingBox.maxX, 
 					boundingBox.minY, 
 					boundingBox.maxY, 
-					pImageData, 
+					pTextonMap, 
+					nTexton, 
 					pTexton);
 }
 
-void Textonator::assignStrayPixels(int * pTextonMap, int nSize)
+/**
+ * The stray pixels of the row pRow (x in [nFirst, nLast]): an out of segment pixel with
+ * a texton on at least 7 of its 8 neighbors joins it, the other out of segment pixels
+ * become UNDEFINED. If 7 neighbors agree, the first two do or the third one is with them,
+ * so the candidate needs no search
+ **/
+static void strayPixelsRow(const int * pUp, const int * pRow, const int * pDown, int * pOut, int nFirst, int nLast)
 {
-	int nOtherTextons[8];
-	int nCurTexton;
+	int x = nFirst;
+
+#ifdef TEXTONATOR_SSE2
+	const __m128i outOfSegment = _mm_set1_epi32(OUT_OF_SEGMENT_DATA);
+	const __m128i undefined = _mm_set1_epi32(UNDEFINED);
+	const __m128i lastNonTexton = _mm_set1_epi32(FIRST_TEXTON_NUM - 1);
+	const __m128i minusSix = _mm_set1_epi32(-6);
+
+	for (; x + 3 <= nLast; x += 4) {
+		__m128i n0 = _mm_loadu_si128((const __m128i *)(pUp + x - 1));
+		__m128i n1 = _mm_loadu_si128((const __m128i *)(pUp + x));
+		__m128i n2 = _mm_loadu_si128((const __m128i *)(pUp + x + 1));
+		__m128i n3 = _mm_loadu_si128((const __m128i *)(pRow + x - 1));
+		__m128i n4 = _mm_loadu_si128((const __m128i *)(pRow + x + 1));
+		__m128i n5 = _mm_loadu_si128((const __m128i *)(pDown + x - 1));
+		__m128i n6 = _mm_loadu_si128((const __m128i *)(pDown + x));
+		__m128i n7 = _mm_loadu_si128((const __m128i *)(pDown + x + 1));
+		__m128i center = _mm_loadu_si128((const __m128i *)(pRow + x));
+
+		__m128i same = _mm_cmpeq_epi32(n0, n1);
+		__m128i texton = _mm_or_si128(_mm_and_si128(same, n0), _mm_andnot_si128(same, n2));
+
+		//the matches are -1 each
+		__m128i matches = _mm_add_epi32(
+			_mm_add_epi32(_mm_add_epi32(_mm_cmpeq_epi32(n0, texton), _mm_cmpeq_epi32(n1, texton)),
+						  _mm_add_epi32(_mm_cmpeq_epi32(n2, texton), _mm_cmpeq_epi32(n3, texton))),
+			_mm_add_epi32(_mm_add_epi32(_mm_cmpeq_epi32(n4, texton), _mm_cmpeq_epi32(n5, texton)),
+						  _mm_add_epi32(_mm_cmpeq_epi32(n6, texton), _mm_cmpeq_epi32(n7, texton))));
+
+		__m128i out = _mm_cmpeq_epi32(center, outOfSegment);
+		__m128i paint = _mm_and_si128(_mm_and_si128(out, _mm_cmplt_epi32(matches, minusSix)),
+									  _mm_cmpgt_epi32(texton, lastNonTexton));
+		__m128i result = _mm_or_si128(_mm_and_si128(out, undefined), _mm_andnot_si128(out, center));
+		result = _mm_or_si128(_mm_and_si128(paint, texton), _mm_andnot_si128(paint, result));
+
+		_mm_storeu_si128((__m128i *)(pOut + x), result);
+	}
+#endif
 
-	int * pNewTextonMap = new int[nSize];
-	memset(pNewTextonMap, UNDEFINED, nSize*sizeof(int));
+	for (; x <= nLast; x++) {
+		int nTexton = (pUp[x - 1] == pUp[x]) ? pUp[x - 1] : pUp[x + 1];
+		int nMatches = (pUp[x - 1] == nTexton) + (pUp[x] == nTexton) + (pUp[x + 1] == nTexton) +
+			(pRow[x - 1] == nTexton) + (pRow[x + 1] == nTexton) +
+			(pDown[x - 1] == nTexton) + (pDown[x] == nTexton) + (pDown[x + 1] == nTexton);
 
-	for (int i = 0; i < m_pOutImg->width; i++){
-		for (int j = 0; j < m_pOutImg->height; j++) {
+		bool fOut = (pRow[x] == OUT_OF_SEGMENT_DATA);
+		bool fPaint = fOut & (nMatches >= 7) & (nTexton >= FIRST_TEXTON_NUM);
+		pOut[x] = fPaint ? nTexton : (fOut ? UNDEFINED : pRow[x]);
+	}
+}
 
-			//Reset the neighbor pixel associations
-			memset(nOtherTextons, UNDEFINED, 8 *sizeof(int));
-			nCurTexton = pTextonMap[j * m_pOutImg->width + i];
+void Textonator::assignStrayPixels(int * pTextonMap)
+{
+	int nWidth = m_pOutImg->width;
+	int nHeight = m_pOutImg->height;
 
-			//we check only out of segment data
-			if (nCurTexton != OUT_OF_SEGMENT_DATA) {
-				pNewTextonMap[j * m_pOutImg->width + i] = pTextonMap[j * m_pOutImg->width + i];
-				continue;
-			}
+	// The former values of the rows y-1, y and y+1, row r in pRows + (r % 3)*nWidth
+	int * pRows = new int[3 * nWidth];
+	memcpy(pRows, pTextonMap, nWidth * sizeof(int));
 
-			getNeighbors(pTextonMap, i, j, m_pOutImg->width, m_pOutImg->height, nOtherTextons);
+	for (int y = 0; y < nHeight; y++) {
+		if (y + 1 < nHeight)
+			memcpy(pRows + ((y + 1) % 3)*nWidth, pTextonMap + (y + 1)*nWidth, nWidth * sizeof(int));
 
-			int nMatchNum = 0;
-			int nCurMatchNum;
-			int nTextonNum = -1;
-			for (int k = 0; k < 8; k++) {
-				nCurMatchNum = 0;
-				for (int l = 0; l < 8; l++){
-					if (nOtherTextons[k] == nOtherTextons[l])
-						nCurMatchNum++;
-				}
-				if (nCurMatchNum >= 7 && nTextonNum == -1)
-					nTextonNum = nOtherTextons[k];
-				nMatchNum += nCurMatchNum;
-			}
+		const int * pRow = pRows + (y % 3)*nWidth;
+		int * pOut = pTextonMap + y*nWidth;
 
-			//if there are more than 7 matched neighbors
-			if (nTextonNum >= FIRST_TEXTON_NUM && nMatchNum >= 7*7){
-				pNewTextonMap[j * m_pOutImg->width + i] = nTextonNum;
-			}
-		}
-	}
+		//as getNeighbors, only the pixels at least 2 pixels from the top and left sides, 
+		//and 1 from the others, have all 8 neighbors, so nothing is read out of the map
+		int nFirst = 2, nLast = nWidth - 2;
+		if (y < 2 || y > nHeight - 2)
+			nFirst = nWidth;
 
-	memcpy(pTextonMap, pNewTextonMap, nSize * sizeof(int));
+		for (int x = 0; x < MIN(nFirst, nWidth); x++)
+			pOut[x] = (pRow[x] == OUT_OF_SEGMENT_DATA) ? UNDEFINED : pRow[x];
+		for (int x = MAX(nLast + 1, nFirst); x < nWidth; x++)
+			pOut[x] = (pRow[x] == OUT_OF_SEGMENT_DATA) ? UNDEFINED : pRow[x];
 
-	delete [] pNewTextonMap;
+		if (nFirst <= nLast)
+			strayPixelsRow(pRows + ((y + 2) % 3)*nWidth, pRow, pRows + ((y + 1) % 3)*nWidth, pOut, nFirst, nLast);
+	}
+
+	delete [] pRows;
 }
 
 void Textonator::getNeighbors(int *map, int i, int j, int width, int height, int arrNeighbors[]) 
@@ -484,56 +907,145 @@ void Textonator::getNeighbors(int *map, int i, int j, int width, int height, int
 		arrNeighbors[3] = map[(j+1) * width + i];
 }
 
-void Textonator::assignRemainingData(int * pTextonMap)
+int Textonator::neighborTexton(int * pTextonMap, int i, int j)
 {
-	int nChanges;
-	int nCurTexton;
-
 	// 8 textons surrounding the current texton
 	int nOtherTextons[8];
 
-	do {
-		nChanges = 0;
+	//Reset the neighbor pixel associations
+	memset(nOtherTextons, UNDEFINED, 8 *sizeof(int));
 
-		for (int i = 0; i < m_pOutImg->width; i++){
-			for (int j = 0; j < m_pOutImg->height; j++) {
+	getNeighbors(pTextonMap, i, j, m_pOutImg->width, m_pOutImg->height, nOtherTextons);
+	m_nRemainingVisits++;
 
-				//Reset the neighbor pixel associations
-				memset(nOtherTextons, UNDEFINED, 8 *sizeof(int));
+	bool fPaint = false;
+	int nClosestTextonColor = UNDEFINED;
+	for (int k = 0; k < 8; k++) {
+		if (nOtherTextons[k] == UNDEFINED)
+			continue;
 
-				nCurTexton = pTextonMap[j * m_pOutImg->width + i];
+		//If there is only texton near the unassigned pixel, become part of it 
+		if (nOtherTextons[k] >= FIRST_TEXTON_NUM) {
+			if (nClosestTextonColor == UNDEFINED){
+				nClosestTextonColor = nOtherTextons[k];
+				fPaint = true;
+			}
+			else if (nClosestTextonColor != nOtherTextons[k]) {
+				fPaint = false;
+			}
+		}
+	}
 
-				//we check only unclustered data
-				if (nCurTexton != UNCLUSTERED_DATA)
-					continue;
+	return fPaint ? nClosestTextonColor : UNDEFINED;
+}
 
-				getNeighbors(pTextonMap, i, j, m_pOutImg->width, m_pOutImg->height, nOtherTextons);
+// Queue a pending pixel: a list is filled in the sweep order, so it only has to skip the repeats
+static inline void pushRemaining(vector<int>& pending, int nIndex)
+{
+	if (pending.empty() || pending.back() < nIndex)
+		pending.push_back(nIndex);
+}
 
-				bool fPaint = false;
-				int nClosestTextonColor = UNDEFINED;
-				for (int k = 0; k < 8; k++) {
-					if (nOtherTextons[k] == UNDEFINED)
-						continue;
+void Textonator::paintRemainingPixel(int * pTextonMap, int nIndex, bool fAhead)
+{
+	int nWidth = m_pOutImg->width;
+	int nHeight = m_pOutImg->height;
+	int i = nIndex / nHeight;
+	int j = nIndex % nHeight;
 
-					//If there is only texton near the unassigned pixel, become part of it 
-					if (nOtherTextons[k] >= FIRST_TEXTON_NUM) {
-						if (nClosestTextonColor == UNDEFINED){
-							nClosestTextonColor = nOtherTextons[k];
-							fPaint = true;
-						}
-						else if (nClosestTextonColor != nOtherTextons[k]) {
-							fPaint = false;
-						}
-					}
-				}
+	//we check only unclustered data
+	if (pTextonMap[j * nWidth + i] != UNCLUSTERED_DATA)
+		return;
 
-				if (fPaint){
-					pTextonMap[j * m_pOutImg->width + i] = nClosestTextonColor;
-					nChanges++;
-				}
-			}
+	int nClosestTextonColor = neighborTexton(pTextonMap, i, j);
+	if (nClosestTextonColor == UNDEFINED)
+		return;
+
+	pTextonMap[j * nWidth + i] = nClosestTextonColor;
+
+	//the unclustered neighbors before it are painted in the next sweep, the ones after it later in this one
+	for (int ni = MAX(i - 1, 0); ni <= MIN(i + 1, nWidth - 1); ni++) {
+		for (int nj = MAX(j - 1, 0); nj <= MIN(j + 1, nHeight - 1); nj++) {
+			if (pTextonMap[nj * nWidth + ni] != UNCLUSTERED_DATA)
+				continue;
+
+			int nNeighbor = ni * nHeight + nj;
+			if (ni < i)
+				pushRemaining(m_remainingPrev, nNeighbor);
+			else if (ni == i && nj < j)
+				pushRemaining(m_remainingAbove, nNeighbor);
+			else if (!fAhead)
+				continue;
+			else if (ni == i)
+				m_nRemainingBelow = nNeighbor;
+			else
+				pushRemaining(m_remainingNext, nNeighbor);
 		}
-	} while (nChanges != 0);
+	}
+}
+
+void Textonator::assignRemainingData(int * pTextonMap)
+{
+	int nWidth = m_pOutImg->width;
+	int nHeight = m_pOutImg->height;
+
+	// The pixels are indexed i*nHeight + j, in the column-major order of the sweeps
+	vector<int> sweep;
+	m_remainingPrev.clear();
+	m_remainingAbove.clear();
+
+	m_nRemainingSweeps = 1;
+	m_nRemainingVisits = 0;
+
+	//the first sweep visits every unclustered pixel, the pixels after a painted one are visited anyway
+	for (int i = 0; i < nWidth; i++){
+		for (int j = 0; j < nHeight; j++) {
+			if (pTextonMap[j * nWidth + i] == UNCLUSTERED_DATA)
+				paintRemainingPixel(pTextonMap, i * nHeight + j, false);
+		}
+	}
+
+	//the next ones only visit the neighbors of the pixels painted since their last visit
+	while (!m_remainingPrev.empty() || !m_remainingAbove.empty()) {
+		m_nRemainingSweeps++;
+
+		//both lists are sorted, so one merge puts the sweep in order
+		sweep.clear();
+		unsigned int nPrev = 0, nAbove = 0;
+		while (nPrev < m_remainingPrev.size() || nAbove < m_remainingAbove.size()) {
+			if (nAbove == m_remainingAbove.size() || 
+				(nPrev < m_remainingPrev.size() && m_remainingPrev[nPrev] < m_remainingAbove[nAbove]))
+				pushRemaining(sweep, m_remainingPrev[nPrev++]);
+			else
+				pushRemaining(sweep, m_remainingAbove[nAbove++]);
+		}
+		m_remainingPrev.clear();
+		m_remainingAbove.clear();
+
+		//the pixels queued during the sweep are below the visited one or in the next column,
+		//so the smallest of the three lists is the next pixel in the sweep order
+		m_remainingNext.clear();
+		m_nRemainingBelow = UNDEFINED;
+		unsigned int nSweep = 0, nNext = 0;
+		for (;;) {
+			int nIndex = m_nRemainingBelow;
+			if (nSweep < sweep.size() && (nIndex == UNDEFINED || sweep[nSweep] < nIndex))
+				nIndex = sweep[nSweep];
+			if (nNext < m_remainingNext.size() && (nIndex == UNDEFINED || m_remainingNext[nNext] < nIndex))
+				nIndex = m_remainingNext[nNext];
+			if (nIndex == UNDEFINED)
+				break;
+
+			if (nSweep < sweep.size() && sweep[nSweep] == nIndex)
+				nSweep++;
+			if (nNext < m_remainingNext.size() && m_remainingNext[nNext] == nIndex)
+				nNext++;
+			if (m_nRemainingBelow == nIndex)
+				m_nRemainingBelow = UNDEFINED;
+
+			paintRemainingPixel(pTextonMap, nIndex, true);
+		}
+	}
 }
 
 void Textonator::extractTextons(int nCluster, vector<Cluster>& clusterList, int * pTextonMap)
@@ -546,13 +1058,15 @@ void Textonator::extractTextons(int nCluster, vector<Cluster>& clusterList, int
 	memset(pTextonMap, 0, nSize*sizeof(int));
 
 	// Extract textons from cluster
-	int nClusterSize = scanForTextons(nCluster, fBackgroundCluster, pTextonMap);
+	int nClusterSize = (m_textonParams.nLabeling == TEXTON_LABELING_UNIONFIND) ? 
+		scanComponents(nCluster, fBackgroundCluster, pTextonMap) :
+		scanForTextons(nCluster, fBackgroundCluster, pTextonMap);
 
 	//assign all the remaining untextoned pixels the closest texton
 	assignRemainingData(pTextonMap);
 
 	//assign any lonely pixels that may appear inside a texton and belong to another cluster to that texton
-	assignStrayPixels(pTextonMap, nSize);
+	assignStrayPixels(pTextonMap);
 
 	retrieveTextons(nClusterSize, nCluster, fBackgroundCluster, pTextonMap, clusterList);
 }
@@ -7,6 +7,9 @@
 #include <highgui.h>
 
 #include "fe/FeatureExtraction.h"
+#include "KMeans.h"
+#include "Superpixels.h"
+#include "ComponentLabeler.h"
 #include "Cluster.h"
 
 using std::vector;
@@ -23,6 +26,32 @@ using std::vector;
 #define MAX_DILATIONS		100
 #define EXTRA_DILATIONS		60
 
+#define TEXTON_LABELING_FLOOD		0
+#define TEXTON_LABELING_UNIONFIND	1
+
+#define TEXTON_EDGES_CLUSTER		0
+#define TEXTON_EDGES_SHARED			1
+
+/**
+ * Parameters of the texton extraction
+ **/
+class STextonParams
+{
+public:
+	STextonParams():nLabeling(TEXTON_LABELING_FLOOD),nEdges(TEXTON_EDGES_CLUSTER) {}
+
+	// TEXTON_LABELING_FLOOD flood fills the textons of each cluster in its own texton map,
+	// TEXTON_LABELING_UNIONFIND labels the components of all the clusters in one pass 
+	// (CComponentLabeler), and only colors the texton maps from the labels.
+	// It is a single pass over the image only with TEXTON_EDGES_SHARED, the cluster
+	// edges still color each cluster and run Canny on it before the labeling
+	int		nLabeling;
+
+	// TEXTON_EDGES_CLUSTER runs Canny on each cluster colored on its own, 
+	// TEXTON_EDGES_SHARED runs it once on the blurred image, and adds the cluster boundaries
+	int		nEdges;
+};
+
 class Occurence
 {
 public:
@@ -40,6 +69,8 @@ public:
 
 class Textonator
 {
+	friend class Benchmark;
+
 public:
 	Textonator(IplImage * Img, int nClusters, int nMinTextonSize, CvScalar& backgroundPixel);
 	virtual ~Textonator();
@@ -48,10 +79,79 @@ public:
 
 	int *	getTextonMap()	{ return m_pUnifiedTextonMap; }
 
+	/**
+	 * The number of clusters, chosen by the sweep if there was one
+	 **/
+	int		getClusterNum()	{ return m_nClusters; }
+
+	void	setFeatureParams(const SFeatureParams& params)	{ m_featureParams = params; }
+	void	setClusterParams(const SClusterParams& params)	{ m_clusterParams = params; }
+	void	setTextonParams(const STextonParams& params)	{ m_textonParams = params; }
+
+	/**
+	 * Keep the principal channels in this directory, and reuse them 
+	 * when the same image is segmented with the same feature parameters
+	 **/
+	void	setFeatureCache(const char * strDir)	{ m_strFeatureCacheDir = strDir; }
+
 private:
 	
 	void	segment();
-	void	cluster(CFeatureExtraction *pFeatureExtractor);
+
+	/**
+	 * Extract the textons of each cluster of m_pClusters
+	 **/
+	void	textonizeClusters(vector<Cluster>& clusterList);
+
+	/**
+	 * Cluster the pixels (or their superpixels) into m_pClusters
+	 **/
+	void	cluster(CvMat * pPrincipalChannels);
+
+	/**
+	 * Normalize the rows, and cluster them with the selected algorithm
+	 * @param pRows rows x PRINCIPAL_CHANNEL_NUM 32F matrix
+	 * @param pLabels [out] rows x 1 32S matrix
+	 **/
+	void	clusterRows(CvMat * pRows, CvMat * pLabels);
+
+	/**
+	 * CKMeans on the normalized channels (or on their compact copy)
+	 * @param pChannels the principal channels, normalized once multiplied by dScale 
+	 * (the compact copies are packed with the scale, the float storage needs dScale = 1)
+	 **/
+	void	clusterKMeans(CvMat * pChannels, double dScale, CvTermCriteria criteria, CvMat * pLabels);
+
+	/**
+	 * CKMeans for each cluster count of the sweep, sets m_nClusters to the one
+	 * with the best Calinski-Harabasz score
+	 * @param pChannels the principal channels, normalized once multiplied by dScale (as in clusterKMeans)
+	 * @param pLabels [out] the labels of the best cluster count
+	 **/
+	void	clusterSweep(CvMat * pChannels, double dScale, CvTermCriteria criteria, CvMat * pLabels);
+
+	template <class TFeatures>
+	void	sweepKMeans(const TFeatures& features, int nAlgorithm, CvTermCriteria criteria, CvMat * pLabels);
+
+	/**
+	 * CMiniBatchKMeans on the normalized channels
+	 **/
+	void	clusterMiniBatch(CvMat * pChannels, CvMat * pLabels);
+
+	/**
+	 * Cluster the mean principal channels of the superpixels,
+	 * and give each pixel the cluster of its superpixel
+	 * @param pSuperpixels superpixels that got the principal channels of all the pixels
+	 **/
+	void	clusterSuperpixels(CSuperpixels * pSuperpixels);
+
+	/**
+	 * CMiniBatchKMeans with tiled feature extraction: the batches are drawn from 
+	 * a sample of the first pass over the tiles, and the pixels are labeled 
+	 * by a second pass, so the principal channels are never kept as a whole.
+	 * With superpixels, a single pass accumulates their mean channels
+	 **/
+	void	clusterStreaming(CFeatureExtraction * pFeatureExtractor);
 
 	/**
 	 * Color all pixels which are not in the cluster nCluster
@@ -66,6 +166,12 @@ private:
 	 **/
 	void	cannyEdgeDetect();
 
+	/**
+	 * The edges of all the clusters in m_pSegmentBoundaries: Canny on m_pSmoothImg,
+	 * and the boundaries between the clusters
+	 **/
+	void	sharedEdgeDetect();
+
 	void	extractTextons(int nCluster, vector<Cluster>& clusterList, int * pTextonMap);
 
 	/**
@@ -77,6 +183,24 @@ private:
 	 **/
 	int		scanForTextons(int nCluster, bool& fBackgroundCluster, int * pTextonMap);
 
+	/**
+	 * Label the components of all the clusters into m_pLabeler.
+	 * A pixel is an edge if it is one in the Canny edges of its own cluster,
+	 * so before any rejection the components are the ones the flood fill of 
+	 * each cluster finds (an edge pixel between two of them may be given to the other one).
+	 * The textons are not always the same: scanForTextons returns a small texton,
+	 * its edge pixels included, to the unclustered pixels, so a later flood fill can
+	 * cross them and absorb the fragment into a larger texton. The components are
+	 * never merged, so the texton maps (and counts) of the two modes may differ
+	 **/
+	void	labelComponents();
+
+	/**
+	 * scanForTextons from the components of m_pLabeler: the ones of nCluster
+	 * larger than the minimal texton size are its textons
+	 **/
+	int		scanComponents(int nCluster, bool& fBackgroundCluster, int * pTextonMap);
+
 	/**
 	 * Color a texton "map" based on the clustering:
      * For pixels inside nCluster:
@@ -93,42 +217,66 @@ private:
 	/**
 	 * "Flood fill" pTextonMap with the value nTexton from the current coordinate
 	 * Stop on borders and when we are out of our cluster
+	 * A scanline fill: whole runs of unclustered pixels are filled along the rows,
+	 * and the runs above and below them are pushed to m_fillStack, so the depth
+	 * does not grow with the texton size. The colored pixels are kept in m_textonPixels
 	 * @param x the x value to check
 	 * @param y the y value to check
-	 * @param pData the image data
 	 * @param pTextonMap the textons location map
 	 * @param nTexton the current texton
 	 **/
-	void	assignTextons(int x, int y, uchar * pData, int * pTextonMap, int nTexton);
+	void	assignTextons(int x, int y, int * pTextonMap, int nTexton);
+
+	/**
+	 * Create a Texton for each texton of the map (and one of all of them, for a background cluster):
+	 * a raster pass collects the bounding boxes, then each is cropped from m_pImg
+	 **/
 	void	retrieveTextons(int nTexton, int nCluster, bool fBackgroundCluster, int * pTextonMap, vector<Cluster>& clusterList);
 	
 	/**
 	 * Assign all the remaining untextoned pixels the closest texton
+	 * The pixels are visited in the order of column-major sweeps until no pixel changes,
+	 * but after the first sweep only the neighbors of newly painted pixels are visited
 	 * @param pTextonMap - texton map to use for assignment
 	 **/
 	void	assignRemainingData(int * pTextonMap);
 
+	/**
+	 * The texton an unclustered pixel joins: its only neighboring texton, UNDEFINED if it has none or several
+	 **/
+	int		neighborTexton(int * pTextonMap, int i, int j);
+
+	/**
+	 * Paint the pixel nIndex (i*height + j) with neighborTexton, and queue its unclustered
+	 * neighbors: the ones before it to the next sweep, the ones after it to this sweep if fAhead
+	 **/
+	void	paintRemainingPixel(int * pTextonMap, int nIndex, bool fAhead);
+
 	/**
 	 * Assign any lonely pixels, that appear inside a texton, 
 	 * and belong to another cluster, to that texton
+	 * (a texton on at least 7 of their 8 neighbors), with a majority filter over
+	 * a ring of 3 rows instead of a copy of the map
 	 * @param ppTextonMap a pointer to the current texton map
-	 * @param nSize the texton map size
 	 **/
-	void	assignStrayPixels(int * ppTextonMap, int nSize);
+	void	assignStrayPixels(int * ppTextonMap);
 
 	/**
-	 * Extract bounding box minX,minY,maxX,maxY from pImageData to pTexton
+	 * Extract bounding box minX,minY,maxX,maxY of the texton nTexton from m_pImg to pTexton
 	 **/
-	void	extractTexton(int minX, int maxX, int minY, int maxY, uchar * pImageData, IplImage* pTexton);
+	void	extractTexton(int minX, int maxX, int minY, int maxY, int * pTextonMap, int nTexton, IplImage* pTexton);
 	
 	/**
-	 * Extract boundingBox from pImageData to pTexton
+	 * Extract boundingBox from m_pImg to pTexton, 
+	 * the pixels of other textons are colored with m_bgColor
 	 * @param boundingBox the bounding box to extract
-	 * @param pImageData the image to extract the data from
+	 * @param pTextonMap the texton map of the cluster
+	 * @param nTexton the texton to extract, UNDEFINED for all the textons of the map
 	 * @param pTexton the texton to extract the data to
 	 **/
-	void	extractTexton(SBox& boundingBox, 
-							uchar * pImageData, 
+	void	extractTexton(SBox& boundingBox, 
+							int * pTextonMap, 
+							int nTexton, 
 							IplImage* pTexton);
 	
 	
@@ -162,8 +310,35 @@ private:
 	int			m_nMinTextonSize;
 	int			m_nCurTextonSize;
 
+	// The pending runs of assignTextons, kept between the calls
+	vector<CvPoint>	m_fillStack;
+
+	// The pixels the last assignTextons colored, so a small texton is undone in its size
+	vector<int>		m_textonPixels;
+
+	// The pixel visits, and the sweeps, of the last assignRemainingData
+	int				m_nRemainingVisits;
+	int				m_nRemainingSweeps;
+
+	// The pending pixels of assignRemainingData, each list sorted as it is filled:
+	// of the next column and the one below, later in this sweep, and of the previous
+	// column and the ones above, in the next sweep
+	vector<int>		m_remainingNext;
+	int				m_nRemainingBelow;
+	vector<int>		m_remainingPrev;
+	vector<int>		m_remainingAbove;
+
 	CvScalar	m_bgColor;
 	CvScalar	m_backgroundPixel;
+
+	SFeatureParams	m_featureParams;
+	SClusterParams	m_clusterParams;
+	STextonParams	m_textonParams;
+
+	// The components of all the clusters, with TEXTON_LABELING_UNIONFIND
+	CComponentLabeler *	m_pLabeler;
+
+	const char *	m_strFeatureCacheDir;
 	
 };
 
@@ -0,0 +1,174 @@
+#include "CompactFeatures.h"
+
+#include <float.h>
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CFloatFeatures::CFloatFeatures(const CvMat * pFeatures)
+{
+	m_pData = pFeatures->data.ptr;
+	m_nStep = pFeatures->step;
+	m_nRows = pFeatures->rows;
+	m_nCols = pFeatures->cols;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFloatFeatures::PrepareCenter(const float * pCenter, float * pPrepared) const
+{
+	for (int c=0;c<m_nCols;c++)
+		pPrepared[c] = pCenter[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFloatFeatures::AddTo(int nRow, double * pSum) const
+{
+	const float * pRow = (const float *)(m_pData + nRow*m_nStep);
+	for (int c=0;c<m_nCols;c++)
+		pSum[c] += pRow[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CHalfFeatures::CHalfFeatures(const CvMat * pFeatures, double dScale)
+{
+	m_nRows = pFeatures->rows;
+	m_nCols = pFeatures->cols;
+	m_pData = new unsigned short[m_nRows * m_nCols];
+
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<m_nRows;i++)
+	{
+		const float * pRow = (const float *)(pFeatures->data.ptr + i*pFeatures->step);
+		for (int c=0;c<m_nCols;c++)
+			m_pData[i*m_nCols+c] = FloatToHalf((float)(pRow[c] * dScale));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CHalfFeatures::~CHalfFeatures()
+{
+	delete [] m_pData;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+unsigned short CHalfFeatures::FloatToHalf(float f)
+{
+	union { float f; unsigned int u; } v;
+	v.f = f;
+
+	unsigned int nSign = (v.u >> 16) & 0x8000;
+	int nExp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+	unsigned int nMant = v.u & 0x7fffff;
+
+	// NaN and infinity
+	if (((v.u >> 23) & 0xff) == 0xff)
+		return (unsigned short)(nSign | 0x7c00 | (nMant ? 0x200 : 0));
+
+	// Too large, becomes infinity
+	if (nExp >= 31)
+		return (unsigned short)(nSign | 0x7c00);
+
+	// Subnormal (or too small, becomes zero)
+	if (nExp <= 0) {
+		if (nExp < -10)
+			return (unsigned short)nSign;
+		nMant = (nMant | 0x800000) >> (1 - nExp);
+		return (unsigned short)(nSign | ((nMant + 0x1000) >> 13));
+	}
+
+	// Round to nearest, a carry out of the mantissa correctly bumps the exponent
+	unsigned int h = nSign | (nExp << 10) | (nMant >> 13);
+	if (nMant & 0x1000)
+		h++;
+	return (unsigned short)h;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CHalfFeatures::PrepareCenter(const float * pCenter, float * pPrepared) const
+{
+	for (int c=0;c<m_nCols;c++)
+		pPrepared[c] = pCenter[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CHalfFeatures::AddTo(int nRow, double * pSum) const
+{
+	const unsigned short * pRow = m_pData + nRow*m_nCols;
+	for (int c=0;c<m_nCols;c++)
+		pSum[c] += HalfToFloat(pRow[c]);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CByteFeatures::CByteFeatures(const CvMat * pFeatures, double dScale)
+{
+	int c;
+
+	m_nRows = pFeatures->rows;
+	m_nCols = pFeatures->cols;
+	m_pData = new uchar[m_nRows * m_nCols];
+	m_pOffset = new float[m_nCols];
+	m_pScale = new float[m_nCols];
+	m_pWeight = new float[m_nCols];
+
+	// The range of each channel (dScale is positive, so it scales the range too)
+	for (c=0;c<m_nCols;c++)
+	{
+		CvMat col;
+		double dMin, dMax;
+		cvGetCol(pFeatures, &col, c);
+		cvMinMaxLoc(&col, &dMin, &dMax);
+		dMin *= dScale;
+		dMax *= dScale;
+
+		m_pOffset[c] = (float)dMin;
+		m_pScale[c] = (float)MAX((dMax - dMin) / 255.0, FLT_MIN);
+		m_pWeight[c] = m_pScale[c] * m_pScale[c];
+	}
+
+#pragma omp parallel for schedule(static)
+	for (int i=0;i<m_nRows;i++)
+	{
+		const float * pRow = (const float *)(pFeatures->data.ptr + i*pFeatures->step);
+		for (int k=0;k<m_nCols;k++)
+		{
+			int q = cvRound((pRow[k] * dScale - m_pOffset[k]) / m_pScale[k]);
+			m_pData[i*m_nCols+k] = (uchar)MIN(MAX(q, 0), 255);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CByteFeatures::~CByteFeatures()
+{
+	delete [] m_pWeight;
+	delete [] m_pScale;
+	delete [] m_pOffset;
+	delete [] m_pData;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CByteFeatures::PrepareCenter(const float * pCenter, float * pPrepared) const
+{
+	for (int c=0;c<m_nCols;c++)
+		pPrepared[c] = (pCenter[c] - m_pOffset[c]) / m_pScale[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CByteFeatures::AddTo(int nRow, double * pSum) const
+{
+	const uchar * pRow = m_pData + nRow*m_nCols;
+	for (int c=0;c<m_nCols;c++)
+		pSum[c] += m_pOffset[c] + m_pScale[c] * pRow[c];
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,291 @@
+#ifndef __COMPACT_FEATURES_H__
+#define __COMPACT_FEATURES_H__
+
+#include <cv.h>
+#include <cxcore.h>
+
+#include "FeatureExtraction.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define FEATURES_SSE
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FEATURES_SSE2
+#endif
+
+#define FEATURE_STORAGE_FLOAT	0
+#define FEATURE_STORAGE_HALF	1
+#define FEATURE_STORAGE_BYTE	2
+
+/**
+ * Squared distance of two vectors of a size known at compile time
+ **/
+template <int nCols>
+inline float SquaredDistance(const float * p1, const float * p2)
+{
+	float fDist = 0;
+	for (int c=0;c<nCols;c++) {
+		float d = p1[c] - p2[c];
+		fDist += d*d;
+	}
+	return fDist;
+}
+
+#ifdef FEATURES_SSE
+/**
+ * The principal channels: three full SSE vectors, and the last four floats 
+ * (11..14) with the lane of float 11 cleared, so nothing is read past the vectors
+ **/
+template <>
+inline float SquaredDistance<15>(const float * p1, const float * p2)
+{
+	__m128 d0 = _mm_sub_ps(_mm_loadu_ps(p1), _mm_loadu_ps(p2));
+	__m128 d1 = _mm_sub_ps(_mm_loadu_ps(p1 + 4), _mm_loadu_ps(p2 + 4));
+	__m128 d2 = _mm_sub_ps(_mm_loadu_ps(p1 + 8), _mm_loadu_ps(p2 + 8));
+	__m128 d3 = _mm_sub_ps(_mm_loadu_ps(p1 + 11), _mm_loadu_ps(p2 + 11));
+	d3 = _mm_move_ss(d3, _mm_setzero_ps());
+
+	__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)),
+							_mm_add_ps(_mm_mul_ps(d2, d2), _mm_mul_ps(d3, d3)));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+	float fDist;
+	_mm_store_ss(&fDist, sum);
+	return fDist;
+}
+#endif
+
+/**
+ * Read only views of a (pixels x channels) feature matrix, used by the k-means.
+ * Every view gives the squared distance of a row from a center directly on
+ * its own storage, after the center was mapped once with PrepareCenter().
+ **/
+
+/**
+ * The plain 32F matrix
+ **/
+class CFloatFeatures
+{
+	public:
+		CFloatFeatures(const CvMat * pFeatures);
+
+		int GetRows() const		{ return m_nRows; }
+		int GetCols() const		{ return m_nCols; }
+		int GetBytes() const	{ return m_nRows * m_nCols * sizeof(float); }
+
+		void PrepareCenter(const float * pCenter, float * pPrepared) const;
+		void AddTo(int nRow, double * pSum) const;
+
+		float Distance(int nRow, const float * pPrepared) const
+		{
+			const float * pRow = (const float *)(m_pData + nRow*m_nStep);
+			if (m_nCols == PRINCIPAL_CHANNEL_NUM)
+				return SquaredDistance<PRINCIPAL_CHANNEL_NUM>(pRow, pPrepared);
+
+			float fDist = 0;
+			for (int c=0;c<m_nCols;c++) {
+				float d = pRow[c] - pPrepared[c];
+				fDist += d*d;
+			}
+			return fDist;
+		}
+
+	protected:
+		const uchar *	m_pData;
+		int				m_nStep;
+		int				m_nRows;
+		int				m_nCols;
+};
+
+/**
+ * IEEE half precision copy of the features
+ **/
+class CHalfFeatures
+{
+	public:
+		/**
+		 * @param dScale the features are pFeatures * dScale, scaled as they are packed
+		 **/
+		CHalfFeatures(const CvMat * pFeatures, double dScale = 1.0);
+		virtual ~CHalfFeatures();
+
+		int GetRows() const		{ return m_nRows; }
+		int GetCols() const		{ return m_nCols; }
+		int GetBytes() const	{ return m_nRows * m_nCols * sizeof(unsigned short); }
+
+		void PrepareCenter(const float * pCenter, float * pPrepared) const;
+		void AddTo(int nRow, double * pSum) const;
+
+		float Distance(int nRow, const float * pPrepared) const
+		{
+			const unsigned short * pRow = m_pData + nRow*m_nCols;
+#ifdef FEATURES_SSE2
+			if (m_nCols == PRINCIPAL_CHANNEL_NUM)
+				return Distance15(pRow, pPrepared);
+#endif
+			float fDist = 0;
+			for (int c=0;c<m_nCols;c++) {
+				float d = HalfToFloat(pRow[c]) - pPrepared[c];
+				fDist += d*d;
+			}
+			return fDist;
+		}
+
+		static unsigned short FloatToHalf(float f);
+
+		static float HalfToFloat(unsigned short h)
+		{
+			union { unsigned int u; float f; } v;
+			unsigned int nSign = (unsigned int)(h & 0x8000) << 16;
+			unsigned int nExp = (h >> 10) & 0x1f;
+			unsigned int nMant = h & 0x3ff;
+
+			if (nExp == 0) {
+				// Zero or subnormal: mant * 2^-24
+				v.f = nMant * (1.0f / 16777216.0f);
+				v.u |= nSign;
+				return v.f;
+			}
+			if (nExp == 31)
+				v.u = nSign | 0x7f800000 | (nMant << 13);
+			else
+				v.u = nSign | ((nExp + 127 - 15) << 23) | (nMant << 13);
+			return v.f;
+		}
+
+#ifdef FEATURES_SSE2
+		/**
+		 * HalfToFloat() of the low half of each 32 bit lane, without branches:
+		 * the exponent and mantissa are moved into place and rebased by 2^112,
+		 * which also normalizes the subnormals; infinity and NaN get the full exponent
+		 **/
+		static __m128 HalfToFloat4(__m128i h)
+		{
+			__m128i expMant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+			__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, expMant), 16);
+			__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expMant, 13)),
+										_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+			__m128i infNan = _mm_and_si128(_mm_cmpgt_epi32(expMant, _mm_set1_epi32(0x7bff)),
+											_mm_set1_epi32(0x7f800000));
+			return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNan)));
+		}
+#endif
+
+	protected:
+#ifdef FEATURES_SSE2
+		/**
+		 * The principal channels: halves 0..7 and 7..14 in two loads, so
+		 * nothing is read past the row, and the lane of the second half 7 cleared
+		 **/
+		static float Distance15(const unsigned short * pRow, const float * pPrepared)
+		{
+			__m128i zero = _mm_setzero_si128();
+			__m128i h0 = _mm_loadu_si128((const __m128i *)pRow);
+			__m128i h1 = _mm_loadu_si128((const __m128i *)(pRow + 7));
+
+			__m128 d0 = _mm_sub_ps(HalfToFloat4(_mm_unpacklo_epi16(h0, zero)), _mm_loadu_ps(pPrepared));
+			__m128 d1 = _mm_sub_ps(HalfToFloat4(_mm_unpackhi_epi16(h0, zero)), _mm_loadu_ps(pPrepared + 4));
+			__m128 d2 = _mm_sub_ps(HalfToFloat4(_mm_unpacklo_epi16(h1, zero)), _mm_loadu_ps(pPrepared + 7));
+			__m128 d3 = _mm_sub_ps(HalfToFloat4(_mm_unpackhi_epi16(h1, zero)), _mm_loadu_ps(pPrepared + 11));
+			d2 = _mm_move_ss(d2, _mm_setzero_ps());
+
+			__m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d0, d0), _mm_mul_ps(d1, d1)),
+									_mm_add_ps(_mm_mul_ps(d2, d2), _mm_mul_ps(d3, d3)));
+			sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+			sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+			float fDist;
+			_mm_store_ss(&fDist, sum);
+			return fDist;
+		}
+#endif
+
+		unsigned short *	m_pData;
+		int					m_nRows;
+		int					m_nCols;
+};
+
+/**
+ * 8 bit quantization of each channel over its own [min, max] range.
+ * The centers are mapped into the quantized units, so the distance is
+ * sum(scale[c]^2 * (q[c] - center[c])^2) without dequantizing the rows.
+ **/
+class CByteFeatures
+{
+	public:
+		/**
+		 * @param dScale the features are pFeatures * dScale, scaled as they are packed
+		 **/
+		CByteFeatures(const CvMat * pFeatures, double dScale = 1.0);
+		virtual ~CByteFeatures();
+
+		int GetRows() const		{ return m_nRows; }
+		int GetCols() const		{ return m_nCols; }
+		int GetBytes() const	{ return m_nRows * m_nCols; }
+
+		void PrepareCenter(const float * pCenter, float * pPrepared) const;
+		void AddTo(int nRow, double * pSum) const;
+
+		float Distance(int nRow, const float * pPrepared) const
+		{
+			const uchar * pRow = m_pData + nRow*m_nCols;
+#ifdef FEATURES_SSE2
+			if (m_nCols == PRINCIPAL_CHANNEL_NUM)
+				return Distance15(pRow, pPrepared);
+#endif
+			float fDist = 0;
+			for (int c=0;c<m_nCols;c++) {
+				float d = pRow[c] - pPrepared[c];
+				fDist += m_pWeight[c]*d*d;
+			}
+			return fDist;
+		}
+
+	protected:
+#ifdef FEATURES_SSE2
+		/**
+		 * The principal channels: bytes 0..7, 8..11 and 11..14, so nothing is
+		 * read past the row, and the lane of the second byte 11 cleared
+		 **/
+		float Distance15(const uchar * pRow, const float * pPrepared) const
+		{
+			__m128i zero = _mm_setzero_si128();
+			__m128i q0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)pRow), zero);
+			__m128i q1 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(pRow + 8)), zero);
+			__m128i q2 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)(pRow + 11)), zero);
+
+			__m128 d0 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q0, zero)), _mm_loadu_ps(pPrepared));
+			__m128 d1 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(q0, zero)), _mm_loadu_ps(pPrepared + 4));
+			__m128 d2 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q1, zero)), _mm_loadu_ps(pPrepared + 8));
+			__m128 d3 = _mm_sub_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(q2, zero)), _mm_loadu_ps(pPrepared + 11));
+			d3 = _mm_move_ss(d3, _mm_setzero_ps());
+
+			__m128 sum = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m_pWeight), _mm_mul_ps(d0, d0)),
+							_mm_mul_ps(_mm_loadu_ps(m_pWeight + 4), _mm_mul_ps(d1, d1))),
+				_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m_pWeight + 8), _mm_mul_ps(d2, d2)),
+							_mm_mul_ps(_mm_loadu_ps(m_pWeight + 11), _mm_mul_ps(d3, d3))));
+			sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+			sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+
+			float fDist;
+			_mm_store_ss(&fDist, sum);
+			return fDist;
+		}
+#endif
+
+		uchar *		m_pData;
+		int			m_nRows;
+		int			m_nCols;
+
+		// value = offset + scale * q, weight = scale^2
+		float *		m_pOffset;
+		float *		m_pScale;
+		float *		m_pWeight;
+};
+
+#endif // __COMPACT_FEATURES_H__
@@ -0,0 +1,124 @@
+#include "CovarianceAccumulator.h"
+
+#include <string.h>
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CCovarianceAccumulator::CCovarianceAccumulator(int nSize):m_nSize(nSize)
+{
+	m_pShift = new double[m_nSize];
+	m_pSum = new double[m_nSize];
+	m_pSumSq = cvCreateMat(m_nSize, m_nSize, CV_64F);
+	Reset();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CCovarianceAccumulator::~CCovarianceAccumulator()
+{
+	cvReleaseMat(&m_pSumSq);
+	delete [] m_pSum;
+	delete [] m_pShift;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CCovarianceAccumulator::Reset()
+{
+	m_dCount = 0;
+	m_fShifted = false;
+	memset(m_pShift, 0, m_nSize*sizeof(double));
+	memset(m_pSum, 0, m_nSize*sizeof(double));
+	cvSetZero(m_pSumSq);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CCovarianceAccumulator::Add(const CvMat * pRows)
+{
+	int nRows = pRows->rows;
+	if (nRows == 0)
+		return;
+
+	// Shift by the first row we see, so the sums stay small
+	if (!m_fShifted) {
+		for (int k=0;k<m_nSize;k++)
+			m_pShift[k] = pRows->data.fl[k];
+		m_fShifted = true;
+	}
+
+	int nBlocks = (nRows + COVARIANCE_BLOCK_ROWS - 1) / COVARIANCE_BLOCK_ROWS;
+
+	// Each thread sums its blocks into its own partial sums, which are reduced at the end
+#pragma omp parallel
+	{
+		CvMat * pBlock = cvCreateMat(COVARIANCE_BLOCK_ROWS, m_nSize, CV_64F);
+		CvMat * pBlockSq = cvCreateMat(m_nSize, m_nSize, CV_64F);
+		CvMat * pSumSq = cvCreateMat(m_nSize, m_nSize, CV_64F);
+		double * pSum = new double[m_nSize];
+
+		cvSetZero(pSumSq);
+		memset(pSum, 0, m_nSize*sizeof(double));
+
+#pragma omp for schedule(static)
+		for (int b=0;b<nBlocks;b++)
+		{
+			int nFirst = b * COVARIANCE_BLOCK_ROWS;
+			int nCount = MIN(COVARIANCE_BLOCK_ROWS, nRows - nFirst);
+
+			for (int i=0;i<nCount;i++)
+			{
+				const float * pSrc = (const float *)(pRows->data.ptr + (nFirst + i)*pRows->step);
+				double * pDst = pBlock->data.db + i*m_nSize;
+				for (int k=0;k<m_nSize;k++)
+				{
+					pDst[k] = pSrc[k] - m_pShift[k];
+					pSum[k] += pDst[k];
+				}
+			}
+
+			CvMat block;
+			cvGetRows(pBlock, &block, 0, nCount);
+			cvMulTransposed(&block, pBlockSq, 1);
+			cvAdd(pSumSq, pBlockSq, pSumSq);
+		}
+
+#pragma omp critical(covariance_reduction)
+		{
+			cvAdd(m_pSumSq, pSumSq, m_pSumSq);
+			for (int k=0;k<m_nSize;k++)
+				m_pSum[k] += pSum[k];
+		}
+
+		delete [] pSum;
+		cvReleaseMat(&pSumSq);
+		cvReleaseMat(&pBlockSq);
+		cvReleaseMat(&pBlock);
+	}
+
+	m_dCount += nRows;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CCovarianceAccumulator::GetCovariance(CvMat * pCovMat)
+{
+	if (m_dCount == 0)
+		return false;
+
+	// cov = E[(x-s)(x-s)'] - E[x-s]E[x-s]'
+	for (int i=0;i<m_nSize;i++)
+	{
+		double dMeanI = m_pSum[i] / m_dCount;
+		for (int j=0;j<m_nSize;j++)
+		{
+			double dMeanJ = m_pSum[j] / m_dCount;
+			double dCov = m_pSumSq->data.db[i*m_nSize+j] / m_dCount - dMeanI * dMeanJ;
+			cvSetReal2D(pCovMat, i, j, dCov);
+		}
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,48 @@
+#ifndef __COVARIANCE_ACCUMULATOR_H__
+#define __COVARIANCE_ACCUMULATOR_H__
+
+#include <cv.h>
+#include <cxcore.h>
+
+#define COVARIANCE_BLOCK_ROWS	1024
+
+/**
+ * Single pass covariance of the rows of feature matrices.
+ * Rows are accumulated in blocks (in double precision, shifted by the first row
+ * for stability), by several threads, so no per-row headers are needed and
+ * the data can be given in several calls (e.g. tile by tile).
+ **/
+class CCovarianceAccumulator
+{
+	public:
+		CCovarianceAccumulator(int nSize);
+		virtual ~CCovarianceAccumulator();
+
+		/**
+		 * Accumulate the rows of a (rows x nSize) 32F matrix
+		 **/
+		void Add(const CvMat * pRows);
+
+		/**
+		 * The covariance of all the rows added so far,
+		 * the same as cvCalcCovarMatrix with CV_COVAR_NORMAL | CV_COVAR_SCALE
+		 * @param pCovMat [out] nSize x nSize 32F matrix
+		 **/
+		bool GetCovariance(CvMat * pCovMat);
+
+		double GetCount()	{ return m_dCount; }
+
+		void Reset();
+
+	protected:
+
+		int			m_nSize;
+		double		m_dCount;
+		bool		m_fShifted;
+
+		double *	m_pShift;
+		double *	m_pSum;
+		CvMat *		m_pSumSq;
+};
+
+#endif // __COVARIANCE_ACCUMULATOR_H__
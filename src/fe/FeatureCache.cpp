@@ -0,0 +1,187 @@
+#include "FeatureCache.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FEATURE_CACHE_MAGIC		0x54414546	// "FEAT"
+#define FEATURE_CACHE_VERSION	1
+
+#define FNV_OFFSET_BASIS		14695981039346656037ULL
+#define FNV_PRIME				1099511628211ULL
+
+// The file starts with this header, the matrix data follows it
+struct SFeatureCacheHeader
+{
+	int			nMagic;
+	int			nVersion;
+	int			nRows;
+	int			nCols;
+	ULONGLONG	key;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+inline ULONGLONG fnv1a(ULONGLONG hash, const void * pData, size_t nSize)
+{
+	const unsigned char * p = (const unsigned char *)pData;
+	for (size_t i=0;i<nSize;i++)
+	{
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CFeatureCache::CFeatureCache(const char * strDir)
+:m_hFile(INVALID_HANDLE_VALUE),m_hMapping(NULL),m_pView(NULL),m_pMat(NULL)
+{
+	strncpy(m_strDir, strDir, MAX_PATH - 1);
+	m_strDir[MAX_PATH - 1] = '\0';
+
+	// Fails harmlessly if it is already there
+	CreateDirectory(m_strDir, NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CFeatureCache::~CFeatureCache()
+{
+	Unmap();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureCache::Unmap()
+{
+	if (m_pMat != NULL)
+		cvReleaseMat(&m_pMat);	// only the header, the data is mapped
+	if (m_pView != NULL)
+		UnmapViewOfFile(m_pView);
+	if (m_hMapping != NULL)
+		CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(m_hFile);
+
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pView = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+ULONGLONG CFeatureCache::GetKey(IplImage * pImg, const SFeatureParams& params)
+{
+	ULONGLONG hash = FNV_OFFSET_BASIS;
+	int i;
+
+	int format[5] = { FEATURE_CACHE_VERSION,
+		pImg->width, pImg->height, pImg->depth, pImg->nChannels };
+	hash = fnv1a(hash, format, sizeof(format));
+
+	// The pixels, without the row padding
+	int nRowSize = pImg->width * pImg->nChannels * ((pImg->depth & 255) / 8);
+	for (i=0;i<pImg->height;i++)
+		hash = fnv1a(hash, pImg->imageData + i*pImg->widthStep, nRowSize);
+
+	// The extraction settings, field by field (the padding is not initialized).
+	// The separable approximation only matters in its own mode
+	bool bSeparable = (params.nGaborMode == GABOR_MODE_SEPARABLE);
+	double dConstants[2] = { GABOR_BASE_FREQUENCY, bSeparable ? params.dGaborMaxError : 0 };
+	int nConstants[9] = { GABOR_FREQUENCIES_NUM, GABOR_ORIENTATIONS_NUM,
+		HISTOGRAM_BINS_NUM, COLOR_CHANNEL_NUM, TEXTURE_CHANNEL_NUM,
+		params.nGaborMode, bSeparable ? params.nGaborRank : 0, params.nHistogramRadius, (int)params.nPcaSeed };
+	hash = fnv1a(hash, dConstants, sizeof(dConstants));
+	hash = fnv1a(hash, nConstants, sizeof(nConstants));
+	hash = fnv1a(hash, &params.dPcaSampleRate, sizeof(params.dPcaSampleRate));
+
+	return hash;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureCache::GetPath(ULONGLONG key, char * strPath, int nSize)
+{
+	sprintf_s(strPath, nSize, "%s\\%08x%08x.feat", m_strDir,
+		(unsigned int)(key >> 32), (unsigned int)(key & 0xffffffff));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CvMat * CFeatureCache::Load(ULONGLONG key)
+{
+	char strPath[MAX_PATH];
+	GetPath(key, strPath, MAX_PATH);
+
+	Unmap();
+
+	m_hFile = CreateFile(strPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	// Matrices of 4 GB and more are not cached
+	DWORD nFileSizeHigh = 0;
+	DWORD nFileSize = GetFileSize(m_hFile, &nFileSizeHigh);
+	if (nFileSizeHigh == 0 && nFileSize >= sizeof(SFeatureCacheHeader)) {
+		m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (m_hMapping != NULL)
+			m_pView = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	}
+
+	if (m_pView == NULL) {
+		Unmap();
+		return NULL;
+	}
+
+	// A matching and complete file
+	const SFeatureCacheHeader * pHeader = (const SFeatureCacheHeader *)m_pView;
+	if (pHeader->nMagic != FEATURE_CACHE_MAGIC ||
+		pHeader->nVersion != FEATURE_CACHE_VERSION ||
+		pHeader->key != key ||
+		nFileSize != sizeof(SFeatureCacheHeader) + (DWORD)pHeader->nRows * pHeader->nCols * sizeof(float)) {
+		Unmap();
+		return NULL;
+	}
+
+	m_pMat = cvCreateMatHeader(pHeader->nRows, pHeader->nCols, CV_32F);
+	cvSetData(m_pMat, (void *)(pHeader + 1), pHeader->nCols * sizeof(float));
+	return m_pMat;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CFeatureCache::Save(ULONGLONG key, const CvMat * pMat)
+{
+	char strPath[MAX_PATH];
+	char strTempPath[MAX_PATH];
+	GetPath(key, strPath, MAX_PATH);
+	sprintf_s(strTempPath, MAX_PATH, "%s.tmp", strPath);
+
+	FILE * fp = fopen(strTempPath, "wb");
+	if (fp == NULL)
+		return false;
+
+	SFeatureCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.nMagic = FEATURE_CACHE_MAGIC;
+	header.nVersion = FEATURE_CACHE_VERSION;
+	header.nRows = pMat->rows;
+	header.nCols = pMat->cols;
+	header.key = key;
+
+	bool fResult = (fwrite(&header, sizeof(header), 1, fp) == 1);
+	for (int i=0;i<pMat->rows && fResult;i++)
+		fResult = (fwrite(pMat->data.ptr + i*pMat->step, sizeof(float), pMat->cols, fp) == (size_t)pMat->cols);
+	fResult = (fclose(fp) == 0) && fResult;
+
+	// Other runs only ever see complete files
+	if (fResult)
+		fResult = (MoveFileEx(strTempPath, strPath, MOVEFILE_REPLACE_EXISTING) != 0);
+	if (!fResult)
+		DeleteFile(strTempPath);
+
+	return fResult;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,56 @@
+#ifndef __FEATURE_CACHE_H__
+#define __FEATURE_CACHE_H__
+
+#include <windows.h>
+#include <cv.h>
+#include <cxcore.h>
+
+#include "FeatureExtraction.h"
+
+/**
+ * A directory of principal channel matrices, one file per key.
+ * The key is a hash of the image pixels and of everything the feature
+ * extraction depends on, so the features of an image are computed once,
+ * and later runs (with other clustering / synthesis parameters) map the
+ * file instead.
+ **/
+class CFeatureCache
+{
+	public:
+		CFeatureCache(const char * strDir);
+		virtual ~CFeatureCache();
+
+		/**
+		 * FNV-1a hash of the image pixels and the feature parameters
+		 **/
+		static ULONGLONG GetKey(IplImage * pImg, const SFeatureParams& params);
+
+		/**
+		 * Map the matrix saved under key
+		 * @return a header over the mapped (read only) file, valid until the
+		 * cache is destroyed, or NULL if there is no such matrix
+		 **/
+		CvMat * Load(ULONGLONG key);
+
+		/**
+		 * Save a 32F matrix under key
+		 **/
+		bool Save(ULONGLONG key, const CvMat * pMat);
+
+	protected:
+
+		void GetPath(ULONGLONG key, char * strPath, int nSize);
+
+		void Unmap();
+
+	protected:
+
+		char		m_strDir[MAX_PATH];
+
+		HANDLE		m_hFile;
+		HANDLE		m_hMapping;
+		const void*	m_pView;
+		CvMat *		m_pMat;
+};
+
+#endif // __FEATURE_CACHE_H__
@@ -1,12 +1,44 @@
 #include "FeatureExtraction.h"
-#include "cvgabor.h"
+#include "GaborFilterBank.h"
+#include "CovarianceAccumulator.h"
 #include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-inline double round2( double d )
+// Copies the tiles into the principal channels of the whole image
+class CMatrixSink : public CFeatureSink
 {
-	return floor( d + 0.5 );
+	public:
+		CMatrixSink(CvMat * pMat, int nWidth):m_pMat(pMat),m_nWidth(nWidth) {}
+
+		virtual void Put(CvRect tile, const CvMat * pRows)
+		{
+			for (int r=0;r<tile.height;r++)
+			{
+				memcpy(m_pMat->data.ptr + ((tile.y + r)*m_nWidth + tile.x)*m_pMat->step,
+					pRows->data.ptr + r*tile.width*pRows->step,
+					tile.width*pRows->step);
+			}
+		}
+
+	protected:
+		CvMat *	m_pMat;
+		int		m_nWidth;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+// Symmetric mirroring of a coordinate outside [0, n)
+inline int mirror( int i, int n )
+{
+	if (i < 0)
+		return -i;
+	if (i >= n)
+		return 2*n-i-1;
+	return i;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
@@ -14,126 +46,121 @@ inline double round2( double d )
 void CFeatureExtraction::CalcHistogram(IplImage * pImg, CvMat * pHistogram, int nBins)
 {
   int step = pImg->widthStep;
-  int channels = m_nChannels;
-  int w = m_nWidth;
-  int h = m_nHeight;
+  int channels = pImg->nChannels;
+  int w = pImg->width;
+  int h = pImg->height;
+  int nCols = channels*nBins;
+  int nRowStride = pHistogram->step / sizeof(float);
   uchar * pData  = (uchar *)pImg->imageData;
-  
+
+  // Mirroring is done once, so the window cannot be larger than the image
+  int r = MAX(0, MIN(m_params.nHistogramRadius, MIN(w, h) - 1));
+
+  // Bin of each value
+  int binLUT[256];
+  for (int v=0;v<256;v++)
+    binLUT[v] = v*nBins/256;
+
+  // Every pixel adds one to its bin in the histograms of the (2r+1)^2 window around it, 
+  // where window positions outside the image are mirrored back in. 
+  // Equivalently, the histogram of the padded position (q,p) counts the (unmirrored) 
+  // window around it, and is added to the histogram of (mirror(q), mirror(p)).
+  // The window is kept as a sliding sum of column histograms, so the cost does not depend on r.
+  int * pColHist = new int[w*nCols];
+  int * pWinHist = new int[nCols];
+  float * pRowHist = new float[w*nCols];
+
+  memset(pColHist, 0, w*nCols*sizeof(int));
   cvSetZero(pHistogram);
-  for (int y=0; y<h; y++)
+
+  for (int q=-r; q<h+r; q++)
     {
-      for (int x=0;x<w; x++)
+      // Slide the column histograms down to the rows [q-r, q+r]
+      int nAddRow = q+r;
+      int nRemoveRow = q-r-1;
+      if (nAddRow < h)
+        {
+          uchar * pRow = pData + nAddRow*step;
+          for (int x=0;x<w;x++)
+            for (int k=0;k<channels;k++)
+              pColHist[x*nCols + k*nBins + binLUT[pRow[x*channels+k]]]++;
+        }
+      if (nRemoveRow >= 0)
+        {
+          uchar * pRow = pData + nRemoveRow*step;
+          for (int x=0;x<w;x++)
+            for (int k=0;k<channels;k++)
+              pColHist[x*nCols + k*nBins + binLUT[pRow[x*channels+k]]]--;
+        }
+
+      // Slide the window along the row, folding the padded columns back into the row
+      memset(pWinHist, 0, nCols*sizeof(int));
+      memset(pRowHist, 0, w*nCols*sizeof(float));
+      for (int p=-r; p<w+r; p++)
         {
-          for (int k=0;k<channels;k++)
+          int * pAdd = (p+r < w) ? &pColHist[(p+r)*nCols] : NULL;
+          int * pRemove = (p-r-1 >= 0) ? &pColHist[(p-r-1)*nCols] : NULL;
+          float * pOut = &pRowHist[mirror(p, w)*nCols];
+
+          for (int k=0;k<nCols;k++)
             {
-              // Get appropriate bin for current pixel
-              uchar val = pData[y*step+x*channels+k];
-              uchar bin = val*nBins/256;
-              
-              // Go over a 5x5 patch, increase appropriate bin by 1
-              for (int j=y-2;j<=y+2;j++)
-                {
-                  
-                  int rj = j;
-                  
-                  // Symmetric mirroring
-                  if (rj<0)
-                    rj = -rj;
-                  if (rj >= h)
-                    rj = 2*h-rj-1;
-                  
-                  
-                  for (int i=x-2;i<=x+2;i++)
-                    {
-                      int ri = i;
-                      
-                      // Symmetric mirroring
-                      if (ri<0)
-                        ri = -ri;
-                      if (ri >= w)
-                        ri = 2*w-ri-1;
-                      
-                      int row = rj*w+ri;
-                      pHistogram->data.fl[row*pHistogram->cols +k*nBins+bin]+=1;
-                    }
-                }
+              if (pAdd)
+                pWinHist[k] += pAdd[k];
+              if (pRemove)
+                pWinHist[k] -= pRemove[k];
+              pOut[k] += (float)pWinHist[k];
             }
         }
+
+      // Fold the padded row back into the image
+      float * pDst = pHistogram->data.fl + mirror(q, h)*w*nRowStride;
+      for (int x=0;x<w;x++)
+        {
+          float * pSrc = &pRowHist[x*nCols];
+          for (int k=0;k<nCols;k++)
+            pDst[k] += pSrc[k];
+          pDst += nRowStride;
+        }
     }
+
+  delete [] pRowHist;
+  delete [] pWinHist;
+  delete [] pColHist;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-bool CFeatureExtraction::GetGaborResponse(IplImage *pGrayImg, IplImage *pResImg, float orientation, float freq, float sx, float sy)
+bool CFeatureExtraction::GetGaborResponse(IplImage * pImgFloat, CvMat * pGaborMat)
 {
-	// Create the filter
-	CvGabor *pGabor = new CvGabor(orientation, freq, sx, sy);
-		
-	// Convolution
-	pGabor->Apply(pGrayImg, pResImg, CV_GABOR_MAG);
-	
-	delete pGabor;
+	// Convert our image to grayscale (Gabor doesn't care about colors! I hope?)	
+	IplImage *pGrayImg = cvCreateImage(cvSize(pImgFloat->width,pImgFloat->height), IPL_DEPTH_32F, 1);
+	cvCvtColor(pImgFloat,pGrayImg,CV_BGR2GRAY);
+
+	m_pGaborBank->Apply(pGrayImg, pGaborMat);
 
+	// Release
+	cvReleaseImage(&pGrayImg);
 	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-bool CFeatureExtraction::GetGaborResponse(CvMat * pGaborMat)
+void CFeatureExtraction::GetTextureVectors(IplImage * pImg, IplImage * pImgFloat, CvMat * pTextureMat)
 {
-	float* pMatPos;
-	int idx = 0;
-	printf("* Acquiring Gabor Responses...\n");	
-
-	// Convert our image to grayscale (Gabor doesn't care about colors! I hope?)	
-	IplImage *pGrayImg = cvCreateImage(cvSize(m_pSrcImg->width,m_pSrcImg->height), IPL_DEPTH_32F, 1);
-	cvCvtColor(m_pSrcImgFloat,pGrayImg,CV_BGR2GRAY);
-
-	// The output image
-	IplImage *reimg = cvCreateImage(cvSize(pGrayImg->width,pGrayImg->height), IPL_DEPTH_32F, 1);
+	// The Gabor responses in the first columns, and the histograms after them
+	CvMat gaborMat, histMat;
+	cvGetCols(pTextureMat, &gaborMat, 0, GABOR_SIZE);
+	cvGetCols(pTextureMat, &histMat, GABOR_SIZE, TEXTURE_VECTOR_SIZE);
 
-	double freq = GABOR_BASE_FREQUENCY;
-	int freq_steps = GABOR_FREQUENCIES_NUM;
-	int ori_count = GABOR_ORIENTATIONS_NUM;
-	double ori_space = PI/ori_count;
+	// Calc the full histogram vectors
+	CalcHistogram(pImg, &histMat, HISTOGRAM_BINS_NUM);
 	
-	int i,j;
-	for (i=0;i<freq_steps;i++)	
-	{
-    	double bw = (2 * freq) / 3;
-    	double sx = round2(0.5 / PI / pow(bw,2));
-    	double sy = round2(0.5 * log(2.0) / pow(PI,2.0) / pow(freq,2.0) / (pow(tan(ori_space / 2),2.0)));	
-    		
-		for (j=0;j<ori_count;j++)
-		{	
-			double ori = j*ori_space;
-			GetGaborResponse(pGrayImg, reimg, ori, freq, sx, sy);
-			
-			// Concat the new vector to the result matrix
-			int k;
-			pMatPos = (float *) pGaborMat->data.fl;
-			float * pResData = (float *) reimg->imageData;
-			for (k=0;k<reimg->width*reimg->height;k++)
-			{
-				pMatPos[idx] = (float) pResData[0];
-				pMatPos += 24;
-				pResData++;
-							
-			}
-
-			idx++;
-		}
-		freq /= 2;	
-	}
-	// Release
-	cvReleaseImage(&reimg);
-	cvReleaseImage(&pGrayImg);
-	return true;
+	GetGaborResponse(pImgFloat, &gaborMat);
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-bool CFeatureExtraction::GetColorChannels(CvMat * pChannels, CvMat * pColorChannelsArr[])
+bool CFeatureExtraction::GetColorChannels(CvMat * pChannels)
 {
 	printf("* Acquiring color channels...\n");	
 	int nSize = COLOR_CHANNEL_NUM;
@@ -146,11 +173,8 @@ bool CFeatureExtraction::GetColorChannels(CvMat * pChannels, CvMat * pColorChann
 	CvMat srcMat;
 	cvInitMatHeader(&srcMat, m_nWidth*m_nHeight, nSize , CV_32F, (float*)pLabImg->imageData );
 
-	// This matrix would hold the values represented in the new basis we've found
-	CvMat * pResultMat = pChannels;
-	
-	// Actual calculation
-	DoPCA(&srcMat, pResultMat, nSize, COLOR_CHANNEL_NUM);
+	// Actual calculation, the result goes straight to its columns in the principal channels
+	DoPCA(&srcMat, pChannels, nSize, COLOR_CHANNEL_NUM);
 
 	// Useful releasing
 	cvReleaseImage(&pLabImg);
@@ -159,35 +183,17 @@ bool CFeatureExtraction::GetColorChannels(CvMat * pChannels, CvMat * pColorChann
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-bool CFeatureExtraction::GetTextureChannels(CvMat * pChannels, CvMat * pTextureChannelsArr[])
+bool CFeatureExtraction::GetTextureChannels(CvMat * pChannels)
 {
 	printf("* Acquiring texture channels...\n");	
 
-	int nGaborSize = GABOR_SIZE;
-	int nHistSize = 30;
-	int nVectorSize = nGaborSize + nHistSize;
-	
-	// Calc the full histogram vectors
-	CvMat * pHistMat = cvCreateMat( m_nWidth*m_nHeight, nHistSize , CV_32F );
-	CalcHistogram(m_pSrcImg, pHistMat, HISTOGRAM_BINS_NUM);
-	
-	CvMat * pGaborMat = cvCreateMat (m_nWidth * m_nHeight, nGaborSize, CV_32F);
-	GetGaborResponse(pGaborMat);
+	// A single matrix for the whole texture vectors
+	CvMat * pTextureMat = cvCreateMat( m_nWidth*m_nHeight, TEXTURE_VECTOR_SIZE, CV_32F );
+	GetTextureVectors(m_pSrcImg, m_pSrcImgFloat, pTextureMat);
 
-	// Our merged matrix
-	CvMat * pTextureMat = cvCreateMat( m_nWidth*m_nHeight, nVectorSize , CV_32F );
-	
-	// Combine into a single matrix
-	MergeMatrices(pGaborMat, pHistMat, pTextureMat);
-
-	// This matrix would hold the values represented in the new basis we've found
-	CvMat * pResultMat = pChannels;
-	
 	// Actual calculation
-	DoPCA(pTextureMat, pResultMat, nVectorSize, TEXTURE_CHANNEL_NUM);
+	DoPCA(pTextureMat, pChannels, TEXTURE_VECTOR_SIZE, TEXTURE_CHANNEL_NUM);
 
-	cvReleaseMat(&pHistMat);
-	cvReleaseMat(&pGaborMat);
 	cvReleaseMat(&pTextureMat);
 	
 	return true;
@@ -198,25 +204,57 @@ bool CFeatureExtraction::GetTextureChannels(CvMat * pChannels, CvMat * pTextureC
 
 bool CFeatureExtraction::DoPCA(CvMat * pMat, CvMat * pResultMat, int nSize, int nExpectedSize)
 {
-	int i;	
+	bool fSampled = m_params.dPcaSampleRate < 1.0;
 
-	// Sort our data sets in a vector each
-	CvMat ** pDataSet = new CvMat*[m_nWidth*m_nHeight];
-	float * pData = pMat->data.fl;
-	for (i=0;i<m_nWidth*m_nHeight;i++)
-	{
-		pDataSet[i] = new CvMat;//(CvMat*) malloc(sizeof(CvMat));
-		cvInitMatHeader(pDataSet[i], 1, nSize, CV_32FC1, &pData[i*nSize]);
-	}
-	
-	// Calc covariance matrix
+	// Calc covariance matrix, straight from the rows of the feature matrix
+	// (or from a sample of them)
 	CvMat* pCovMat = cvCreateMat( nSize, nSize, CV_32F );
-	CvMat* pMeanVec = cvCreateMat( 1, nSize, CV_32F );
-	
-	cvCalcCovarMatrix( (const void **)pDataSet, m_nWidth*m_nHeight, pCovMat, pMeanVec, CV_COVAR_SCALE | CV_COVAR_NORMAL );
-	
-	cvReleaseMat(&pMeanVec);
-	
+
+	CCovarianceAccumulator covariance(nSize);
+	if (fSampled) {
+		CvMat * pSampleMat = SampleRows(pMat, m_params.dPcaSampleRate, m_params.nPcaSeed);
+		covariance.Add(pSampleMat);
+		cvReleaseMat(&pSampleMat);
+	}
+	else {
+		covariance.Add(pMat);
+	}
+	covariance.GetCovariance(pCovMat);
+
+	// Extract the requested number of dominant eigen vectors
+	CvMat* pEigenVecs = cvCreateMat( nSize, nExpectedSize, CV_32F );
+	GetEigenVectors(pCovMat, pEigenVecs);
+
+	if (fSampled && m_params.fPcaDiagnostics) {
+		// Compare with the eigen vectors of all the rows
+		CvMat* pExactVecs = cvCreateMat( nSize, nExpectedSize, CV_32F );
+		covariance.Reset();
+		covariance.Add(pMat);
+		covariance.GetCovariance(pCovMat);
+		GetEigenVectors(pCovMat, pExactVecs);
+
+		printf("PCA (%d -> %d) sampled at %.1f%%: subspace angle to the exact eigen vectors = %.4f degrees\n",
+			nSize, nExpectedSize, m_params.dPcaSampleRate*100, GetSubspaceAngle(pEigenVecs, pExactVecs));
+
+		cvReleaseMat(&pExactVecs);
+	}
+	cvReleaseMat(&pCovMat);
+
+	// Transform to the new basis	
+	Project(pMat, pEigenVecs, pResultMat);
+	cvReleaseMat(&pEigenVecs);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureExtraction::GetEigenVectors(CvMat * pCovMat, CvMat * pEigenVecs)
+{
+	int i;
+	int nSize = pCovMat->rows;
+	int nExpectedSize = pEigenVecs->cols;
+
 	// Do the SVD decomposition
 	CvMat* pMatW = cvCreateMat( nSize, 1, CV_32F );
 	CvMat* pMatV = cvCreateMat( nSize, nSize, CV_32F );
@@ -224,60 +262,273 @@ bool CFeatureExtraction::DoPCA(CvMat * pMat, CvMat * pResultMat, int nSize, int
 	
 	cvSVD(pCovMat, pMatW, pMatU, pMatV, CV_SVD_MODIFY_A+CV_SVD_V_T);
 	
-	cvReleaseMat(&pCovMat);
 	cvReleaseMat(&pMatW);
 	cvReleaseMat(&pMatV);
 
-	// Extract the requested number of dominant eigen vectors
-	CvMat* pEigenVecs = cvCreateMat( nSize, nExpectedSize, CV_32F );
 	for (i=0;i<nSize;i++)
 		memcpy(&pEigenVecs->data.fl[i*nExpectedSize], &pMatU->data.fl[i*nSize], nExpectedSize*sizeof(float));
 
-	// Transform to the new basis	
-	cvMatMul(pMat, pEigenVecs, pResultMat);
 	cvReleaseMat(&pMatU);
-	cvReleaseMat(&pEigenVecs);
-	
-	for (i = 0; i < m_nHeight * m_nWidth; i++)
-		delete [] pDataSet[i];
-	delete [] pDataSet;
+}
 
-	return true;
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureExtraction::Project(CvMat * pMat, CvMat * pEigenVecs, CvMat * pResultMat)
+{
+	int nRows = pMat->rows;
+	int nBlocks = (nRows + COVARIANCE_BLOCK_ROWS - 1) / COVARIANCE_BLOCK_ROWS;
+
+	// Every block of rows is projected straight into its place in the result
+#pragma omp parallel for schedule(static)
+	for (int b=0;b<nBlocks;b++)
+	{
+		int nFirst = b * COVARIANCE_BLOCK_ROWS;
+		int nLast = MIN(nFirst + COVARIANCE_BLOCK_ROWS, nRows);
+
+		CvMat src, dst;
+		cvGetRows(pMat, &src, nFirst, nLast);
+		cvGetRows(pResultMat, &dst, nFirst, nLast);
+		cvMatMul(&src, pEigenVecs, &dst);
+	}
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-bool CFeatureExtraction::MergeMatrices(CvMat * pMatrix1, CvMat * pMatrix2, CvMat * pResultMat)
+CvMat * CFeatureExtraction::SampleRows(CvMat * pMat, double dRate, unsigned int nSeed)
 {
-	// Go over row by row, concat the two matrices
-	char * pResData= (char *) pResultMat->data.ptr;
-	char * pData1 = (char *)  pMatrix1->data.ptr;
-	char * pData2 = (char *)  pMatrix2->data.ptr;
-	
-	int step1 = pMatrix1->step;
-	int step2 = pMatrix2->step;
-	
-	int i;
-	for (i=0;i<pResultMat->rows;i++)
+	int nRows = pMat->rows;
+	int nStride = MAX(cvRound(1.0 / dRate), 1);
+	int nSamples = (nRows + nStride - 1) / nStride;
+	int nRowSize = pMat->cols * CV_ELEM_SIZE(pMat->type);
+
+	CvMat * pSampleMat = cvCreateMat(nSamples, pMat->cols, pMat->type);
+	CvRNG rng = cvRNG(nSeed);
+
+	// Stratified in raster order, so every part of the image is represented
+	for (int i=0;i<nSamples;i++)
 	{
-		memcpy(pResData, pData1, step1);
-		pResData+=step1;
-		pData1+=step1;
-		
-		memcpy(pResData, pData2, step2);
-		pResData+=step2;
-		pData2+=step2;
+		int nFirst = i * nStride;
+		int nRow = nFirst + cvRandInt(&rng) % MIN(nStride, nRows - nFirst);
+		memcpy(pSampleMat->data.ptr + i*pSampleMat->step, pMat->data.ptr + nRow*pMat->step, nRowSize);
 	}
-	
-	return true;
+
+	return pSampleMat;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
-CFeatureExtraction::CFeatureExtraction(IplImage * pSrcImg)
-{	
-	int i;
+double CFeatureExtraction::GetSubspaceAngle(CvMat * pVecs1, CvMat * pVecs2)
+{
+	int nSize = pVecs1->cols;
+
+	// The cosines of the principal angles are the singular values of V1'V2
+	CvMat* pProduct = cvCreateMat( nSize, nSize, CV_32F );
+	CvMat* pMatW = cvCreateMat( nSize, 1, CV_32F );
+
+	cvGEMM(pVecs1, pVecs2, 1, NULL, 0, pProduct, CV_GEMM_A_T);
+	cvSVD(pProduct, pMatW, NULL, NULL, CV_SVD_MODIFY_A);
+
+	// Sorted in descending order, so the last is the largest angle
+	double dCos = MIN(MAX(pMatW->data.fl[nSize-1], 0.0f), 1.0f);
+
+	cvReleaseMat(&pMatW);
+	cvReleaseMat(&pProduct);
+
+	return acos(dCos) * 180.0 / CV_PI;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+int CFeatureExtraction::GetTileSize()
+{
+	if (m_params.nMemoryLimit <= 0)
+		return 0;
+
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+
+	// The principal channels are kept for the whole image
+	double dBudget = m_params.nMemoryLimit * 1024.0 * 1024.0 - 
+		(double)m_nWidth * m_nHeight * (COLOR_CHANNEL_NUM + TEXTURE_CHANNEL_NUM) * sizeof(float);
+
+	// Bytes per pixel of an extended tile: the 8 bit, float, Lab and gray tiles, 
+	// the texture vectors of the extended tile and of the tile, the projected tile,
+	// and the image spectrum and the scratch buffers of the Gabor workers
+	// (the bank runs fewer workers when theirs do not fit GABOR_MEMORY_BUDGET)
+	double dPerPixel = 3 + sizeof(float) * (3 + 3 + 1 + 2*TEXTURE_VECTOR_SIZE + 
+		COLOR_CHANNEL_NUM + TEXTURE_CHANNEL_NUM + 2 + 3*nThreads);
+
+	int nSize = (int)sqrt(MAX(dBudget, 0.0) / dPerPixel) - 2*m_nHalo;
+	nSize = nSize / TILE_ALIGNMENT * TILE_ALIGNMENT;
+	if (nSize < TILE_MIN_SIZE) {
+		printf("The memory limit (%d MB) is too low, using %dx%d tiles\n", 
+			m_params.nMemoryLimit, TILE_MIN_SIZE, TILE_MIN_SIZE);
+		nSize = TILE_MIN_SIZE;
+	}
+
+	// A single tile is the whole image
+	if (nSize >= m_nWidth && nSize >= m_nHeight)
+		return 0;
+
+	return nSize;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureExtraction::GetTileVectors(CvRect tile, CvMat * pColorMat, CvMat * pTextureMat)
+{
+	int r;
+
+	// Extend the tile by the halo. At the image borders the tile borders are 
+	// the image borders, which are handled the same way in both modes
+	int x0 = MAX(tile.x - m_nHalo, 0) / TILE_ALIGNMENT * TILE_ALIGNMENT;
+	int y0 = MAX(tile.y - m_nHalo, 0) / TILE_ALIGNMENT * TILE_ALIGNMENT;
+	int x1 = MIN(tile.x + tile.width + m_nHalo, m_nWidth);
+	int y1 = MIN(tile.y + tile.height + m_nHalo, m_nHeight);
+	CvRect extended = cvRect(x0, y0, x1 - x0, y1 - y0);
+
+	CvMat srcMat;
+	cvGetSubRect(m_pSrcImg, &srcMat, extended);
+	IplImage * pImg = cvCreateImage(cvSize(extended.width, extended.height), m_pSrcImg->depth, m_pSrcImg->nChannels);
+	cvCopy(&srcMat, pImg);
 
+	IplImage * pImgFloat = cvCreateImage(cvSize(extended.width, extended.height), IPL_DEPTH_32F, 3);
+	cvConvertScale(pImg, pImgFloat, 1.0, 0);
+
+	CvMat * pExtendedMat = cvCreateMat(extended.width*extended.height, TEXTURE_VECTOR_SIZE, CV_32F);
+	GetTextureVectors(pImg, pImgFloat, pExtendedMat);
+
+	// Keep the rows of the tile itself
+	int dx = tile.x - x0;
+	int dy = tile.y - y0;
+	for (r=0;r<tile.height;r++)
+	{
+		memcpy(pTextureMat->data.ptr + r*tile.width*pTextureMat->step,
+			pExtendedMat->data.ptr + ((dy + r)*extended.width + dx)*pExtendedMat->step,
+			tile.width*pTextureMat->step);
+	}
+
+	// The color vectors do not depend on the neighbours
+	CvMat floatMat;
+	cvGetSubRect(pImgFloat, &floatMat, cvRect(dx, dy, tile.width, tile.height));
+	IplImage * pLabImg = cvCreateImage(cvSize(tile.width, tile.height), IPL_DEPTH_32F, COLOR_CHANNEL_NUM);
+	cvCvtColor(&floatMat, pLabImg, CV_BGR2Lab);
+
+	CvMat labMat;
+	cvInitMatHeader(&labMat, tile.width*tile.height, COLOR_CHANNEL_NUM, CV_32F, (float*)pLabImg->imageData);
+	cvCopy(&labMat, pColorMat);
+
+	cvReleaseImage(&pLabImg);
+	cvReleaseMat(&pExtendedMat);
+	cvReleaseImage(&pImgFloat);
+	cvReleaseImage(&pImg);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureExtraction::AccumulateTiles()
+{
+	int nTilesX = (m_nWidth + m_nTileSize - 1) / m_nTileSize;
+	int nTilesY = (m_nHeight + m_nTileSize - 1) / m_nTileSize;
+	int nTiles = nTilesX * nTilesY;
+
+	printf("* Acquiring color and texture channels by %d tiles of %dx%d (%d pixels halo)...\n", 
+		nTiles, m_nTileSize, m_nTileSize, m_nHalo);
+
+	CvMat * pColorMat = cvCreateMat(m_nTileSize*m_nTileSize, COLOR_CHANNEL_NUM, CV_32F);
+	CvMat * pTextureMat = cvCreateMat(m_nTileSize*m_nTileSize, TEXTURE_VECTOR_SIZE, CV_32F);
+	CvMat colorMat, textureMat;
+
+	// The covariances of the vectors (or of a sample of them)
+	CCovarianceAccumulator colorCovariance(COLOR_CHANNEL_NUM);
+	CCovarianceAccumulator textureCovariance(TEXTURE_VECTOR_SIZE);
+
+	for (int nTile=0;nTile<nTiles;nTile++)
+	{
+		int x = (nTile % nTilesX) * m_nTileSize;
+		int y = (nTile / nTilesX) * m_nTileSize;
+		CvRect tile = cvRect(x, y, MIN(m_nTileSize, m_nWidth - x), MIN(m_nTileSize, m_nHeight - y));
+
+		cvGetRows(pColorMat, &colorMat, 0, tile.width*tile.height);
+		cvGetRows(pTextureMat, &textureMat, 0, tile.width*tile.height);
+		GetTileVectors(tile, &colorMat, &textureMat);
+
+		if (m_params.dPcaSampleRate < 1.0) {
+			CvMat * pSampleMat = SampleRows(&colorMat, m_params.dPcaSampleRate, m_params.nPcaSeed + nTile);
+			colorCovariance.Add(pSampleMat);
+			cvReleaseMat(&pSampleMat);
+
+			pSampleMat = SampleRows(&textureMat, m_params.dPcaSampleRate, m_params.nPcaSeed + nTile);
+			textureCovariance.Add(pSampleMat);
+			cvReleaseMat(&pSampleMat);
+		}
+		else {
+			colorCovariance.Add(&colorMat);
+			textureCovariance.Add(&textureMat);
+		}
+	}
+
+	m_pColorVecs = cvCreateMat(COLOR_CHANNEL_NUM, COLOR_CHANNEL_NUM, CV_32F);
+	CvMat * pCovMat = cvCreateMat(COLOR_CHANNEL_NUM, COLOR_CHANNEL_NUM, CV_32F);
+	colorCovariance.GetCovariance(pCovMat);
+	GetEigenVectors(pCovMat, m_pColorVecs);
+	cvReleaseMat(&pCovMat);
+
+	m_pTextureVecs = cvCreateMat(TEXTURE_VECTOR_SIZE, TEXTURE_CHANNEL_NUM, CV_32F);
+	pCovMat = cvCreateMat(TEXTURE_VECTOR_SIZE, TEXTURE_VECTOR_SIZE, CV_32F);
+	textureCovariance.GetCovariance(pCovMat);
+	GetEigenVectors(pCovMat, m_pTextureVecs);
+	cvReleaseMat(&pCovMat);
+
+	cvReleaseMat(&pTextureMat);
+	cvReleaseMat(&pColorMat);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CFeatureExtraction::ProjectTiles(CFeatureSink * pSink)
+{
+	int nTilesX = (m_nWidth + m_nTileSize - 1) / m_nTileSize;
+	int nTilesY = (m_nHeight + m_nTileSize - 1) / m_nTileSize;
+	int nTiles = nTilesX * nTilesY;
+
+	CvMat * pColorMat = cvCreateMat(m_nTileSize*m_nTileSize, COLOR_CHANNEL_NUM, CV_32F);
+	CvMat * pTextureMat = cvCreateMat(m_nTileSize*m_nTileSize, TEXTURE_VECTOR_SIZE, CV_32F);
+	CvMat * pResultMat = cvCreateMat(m_nTileSize*m_nTileSize, COLOR_CHANNEL_NUM+TEXTURE_CHANNEL_NUM, CV_32F);
+	CvMat colorMat, textureMat;
+
+	for (int nTile=0;nTile<nTiles;nTile++)
+	{
+		int x = (nTile % nTilesX) * m_nTileSize;
+		int y = (nTile / nTilesX) * m_nTileSize;
+		CvRect tile = cvRect(x, y, MIN(m_nTileSize, m_nWidth - x), MIN(m_nTileSize, m_nHeight - y));
+
+		cvGetRows(pColorMat, &colorMat, 0, tile.width*tile.height);
+		cvGetRows(pTextureMat, &textureMat, 0, tile.width*tile.height);
+		GetTileVectors(tile, &colorMat, &textureMat);
+
+		CvMat resultMat, colorResult, textureResult;
+		cvGetRows(pResultMat, &resultMat, 0, tile.width*tile.height);
+		cvGetCols(&resultMat, &colorResult, 0, COLOR_CHANNEL_NUM);
+		cvGetCols(&resultMat, &textureResult, COLOR_CHANNEL_NUM, COLOR_CHANNEL_NUM+TEXTURE_CHANNEL_NUM);
+
+		Project(&colorMat, m_pColorVecs, &colorResult);
+		Project(&textureMat, m_pTextureVecs, &textureResult);
+
+		pSink->Put(tile, &resultMat);
+	}
+
+	cvReleaseMat(&pResultMat);
+	cvReleaseMat(&pTextureMat);
+	cvReleaseMat(&pColorMat);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CFeatureExtraction::CFeatureExtraction(IplImage * pSrcImg, const SFeatureParams& params):m_params(params)
+{	
 	m_pSrcImg = pSrcImg;
 	
 	// Extract parameters
@@ -285,51 +536,82 @@ CFeatureExtraction::CFeatureExtraction(IplImage * pSrcImg)
 	m_nWidth = m_pSrcImg->width;
 	m_nHeight = m_pSrcImg->height; 	
 	
-	// Scale to a 32bit float image (needed for later stages)
-	m_pSrcImgFloat = cvCreateImage(cvSize(m_nWidth,m_nHeight),IPL_DEPTH_32F,3);
-	cvConvertScale(m_pSrcImg,m_pSrcImgFloat,1.0,0);
-	
-	for (i=0;i<COLOR_CHANNEL_NUM;i++)
-		m_pColorChannelsArr[i] = cvCreateMat( m_nHeight , m_nWidth , CV_32F );
-
-	for (i = 0; i < TEXTURE_CHANNEL_NUM; i++)
-		m_pTextureChannelsArr[i] = cvCreateMat(m_nHeight, m_nWidth, CV_32F);
+	m_pGaborBank = new CGaborFilterBank(m_params.nGaborMode, m_params.nGaborRank, m_params.dGaborMaxError);
+
+	m_nHalo = MAX(m_pGaborBank->GetHalo(), m_params.nHistogramRadius);
+	m_nTileSize = GetTileSize();
+	m_pColorVecs = NULL;
+	m_pTextureVecs = NULL;
+
+	// Scale to a 32bit float image (needed for later stages),
+	// in the tiled mode each tile is scaled on its own
+	m_pSrcImgFloat = NULL;
+	if (m_nTileSize == 0) {
+		m_pSrcImgFloat = cvCreateImage(cvSize(m_nWidth,m_nHeight),IPL_DEPTH_32F,3);
+		cvConvertScale(m_pSrcImg,m_pSrcImgFloat,1.0,0);
+	}
 
-	m_pTextureChannels = cvCreateMat(m_nHeight * m_nWidth, TEXTURE_CHANNEL_NUM,  CV_32F);
-	m_pColorChannels = cvCreateMat(m_nHeight * m_nWidth, COLOR_CHANNEL_NUM,  CV_32F);
-	m_pPrincipalChannels = cvCreateMat(m_nHeight * m_nWidth, COLOR_CHANNEL_NUM+TEXTURE_CHANNEL_NUM,  CV_32F);
+	m_pPrincipalChannels = NULL;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
 CFeatureExtraction::~CFeatureExtraction()
 {
-	int i;
-
-	cvReleaseImage(&m_pSrcImgFloat);
-
-	for (i=0;i<COLOR_CHANNEL_NUM;i++)
-		cvReleaseMat(&m_pColorChannelsArr[i]);
-	for (i=0;i<TEXTURE_CHANNEL_NUM;i++)
-		cvReleaseMat(&m_pTextureChannelsArr[i]);
-		
-	cvReleaseMat(&m_pTextureChannels);
-	cvReleaseMat(&m_pColorChannels);
-	cvReleaseMat(&m_pPrincipalChannels);
+	if (m_pSrcImgFloat != NULL)
+		cvReleaseImage(&m_pSrcImgFloat);
+	if (m_pPrincipalChannels != NULL)
+		cvReleaseMat(&m_pPrincipalChannels);
+	if (m_pColorVecs != NULL) {
+		cvReleaseMat(&m_pColorVecs);
+		cvReleaseMat(&m_pTextureVecs);
+	}
+	delete m_pGaborBank;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
 
 bool CFeatureExtraction::run()
 {
-	GetColorChannels(m_pColorChannels, m_pColorChannelsArr);
+	if (m_pPrincipalChannels != NULL)
+		return true;
 
-	GetTextureChannels(m_pTextureChannels, m_pTextureChannelsArr);
-	
-	MergeMatrices(m_pColorChannels, m_pTextureChannels, m_pPrincipalChannels);
+	// The color and texture channels are views on the principal channels
+	m_pPrincipalChannels = cvCreateMat(m_nHeight * m_nWidth, COLOR_CHANNEL_NUM+TEXTURE_CHANNEL_NUM,  CV_32F);
+	cvGetCols(m_pPrincipalChannels, &m_colorChannels, 0, COLOR_CHANNEL_NUM);
+	cvGetCols(m_pPrincipalChannels, &m_textureChannels, COLOR_CHANNEL_NUM, COLOR_CHANNEL_NUM+TEXTURE_CHANNEL_NUM);
+
+	if (m_nTileSize > 0) {
+		CMatrixSink sink(m_pPrincipalChannels, m_nWidth);
+		AccumulateTiles();
+		ProjectTiles(&sink);
+	}
+	else {
+		GetColorChannels(&m_colorChannels);
+
+		GetTextureChannels(&m_textureChannels);
+	}
 	
 	printf(">>> Feature Extraction phase completed successfully! <<<\n\n");
 	return true;
 }
 
 //////////////////////////////////////////////////////////////////////////////////////
+
+bool CFeatureExtraction::run(CFeatureSink * pSink)
+{
+	// The whole image is a single tile
+	if (m_nTileSize == 0) {
+		run();
+		pSink->Put(cvRect(0, 0, m_nWidth, m_nHeight), m_pPrincipalChannels);
+		return true;
+	}
+
+	if (m_pColorVecs == NULL)
+		AccumulateTiles();
+	ProjectTiles(pSink);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
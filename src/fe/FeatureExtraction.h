@@ -8,6 +8,7 @@
 
 #define COLOR_CHANNEL_NUM	3
 #define TEXTURE_CHANNEL_NUM	12
+#define PRINCIPAL_CHANNEL_NUM	(COLOR_CHANNEL_NUM + TEXTURE_CHANNEL_NUM)
 
 #define GABOR_BASE_FREQUENCY	0.4
 #define GABOR_FREQUENCIES_NUM	4
@@ -15,39 +16,174 @@
 #define GABOR_SIZE				(GABOR_FREQUENCIES_NUM * GABOR_ORIENTATIONS_NUM)
 
 #define HISTOGRAM_BINS_NUM		10
+#define HISTOGRAM_RADIUS		2
+
+// Gabor responses followed by the color histograms
+#define TEXTURE_VECTOR_SIZE		(GABOR_SIZE + COLOR_CHANNEL_NUM * HISTOGRAM_BINS_NUM)
+
+#define GABOR_MODE_SPATIAL		0
+#define GABOR_MODE_FFT			1
+#define GABOR_MODE_OCTAVE		2
+#define GABOR_MODE_SEPARABLE	3
+
+// Smallest tile side of the tiled mode, and the alignment of the tiles
+// (so the octave pyramid of a tile falls on the pyramid of the image)
+#define TILE_MIN_SIZE			64
+#define TILE_ALIGNMENT			(1 << (GABOR_FREQUENCIES_NUM - 1))
+
+class CGaborFilterBank;
+
+/**
+ * Parameters of the feature extraction stages
+ **/
+class SFeatureParams
+{
+public:
+	SFeatureParams():nGaborMode(GABOR_MODE_FFT),nGaborRank(3),dGaborMaxError(0.01),
+		nHistogramRadius(HISTOGRAM_RADIUS),dPcaSampleRate(1.0),nPcaSeed(1),fPcaDiagnostics(false),
+		nMemoryLimit(0) {}
+
+	int		nGaborMode;
+
+	// GABOR_MODE_SEPARABLE: maximal number of separable terms per kernel, 
+	// and the kernel error (relative) at which to stop adding terms
+	int		nGaborRank;
+	double	dGaborMaxError;
+
+	// The local histograms are taken over a (2*radius+1)^2 window
+	int		nHistogramRadius;
+
+	// The PCA covariance is estimated from a stratified sample of this fraction 
+	// of the pixels (1 for all of them), drawn with the given seed
+	double	dPcaSampleRate;
+	unsigned int nPcaSeed;
+
+	// Report the subspace angle between the sampled and the exact eigen vectors
+	bool	fPcaDiagnostics;
+
+	// Memory ceiling (MB) of the feature extraction. If the whole image does not 
+	// fit in it, the features are computed by overlapping tiles. 0 for no limit
+	int		nMemoryLimit;
+};
+
+/**
+ * Receives the principal channels as they are computed, a tile at a time
+ **/
+class CFeatureSink
+{
+	public:
+		virtual ~CFeatureSink() {}
+
+		/**
+		 * @param tile the pixels of the rows
+		 * @param pRows (tile pixels) x PRINCIPAL_CHANNEL_NUM 32F matrix, in raster order
+		 **/
+		virtual void Put(CvRect tile, const CvMat * pRows) = 0;
+};
 
 class CFeatureExtraction 
 {
 	public:
-		CFeatureExtraction(IplImage * pSrcImg);
+		CFeatureExtraction(IplImage * pSrcImg, const SFeatureParams& params = SFeatureParams());
 		virtual ~CFeatureExtraction();
 
+		/**
+		 * Compute the principal channels of the whole image
+		 **/
 		bool run();
+
+		/**
+		 * Pass the principal channels to pSink. In the tiled mode they are never
+		 * kept for the whole image: the eigen vectors are computed by the first call, 
+		 * and every call computes the tiles again and passes them one by one
+		 **/
+		bool run(CFeatureSink * pSink);
+
+		bool IsTiled() const	{ return m_nTileSize > 0; }
 		
 	public:
-		CvMat ** GetColorChannelsArr()  { return m_pColorChannelsArr; }
-		CvMat ** GetTextureChannelsArr()  { return m_pTextureChannelsArr; }	
-		
-		CvMat * GetColorChannels()  { return m_pColorChannels; }
-		CvMat * GetTextureChannels()  { return m_pTextureChannels; }	
+		CvMat * GetColorChannels()  { return &m_colorChannels; }
+		CvMat * GetTextureChannels()  { return &m_textureChannels; }	
 		
 		CvMat * GetPrincipalChannels() { return m_pPrincipalChannels; }
 
 	protected:
 
-		bool GetColorChannels(CvMat * pChannels, CvMat * pColorChannelsArr[]);
-		bool GetTextureChannels(CvMat * pChannels, CvMat * pTextureChannelsArr[]);
+		bool GetColorChannels(CvMat * pChannels);
+		bool GetTextureChannels(CvMat * pChannels);
 		
-		bool GetGaborResponse(CvMat * pGaborMat);
-		bool GetGaborResponse(IplImage *pGrayImg, IplImage *pResImg, float orientation, float freq, float sx, float sy);
+		bool GetGaborResponse(IplImage * pImgFloat, CvMat * pGaborMat);
+
+		/**
+		 * The Gabor responses and the histograms of each pixel of an image
+		 * @param pImg 8 bit image
+		 * @param pImgFloat the same image in 32F
+		 * @param pTextureMat [out] (width*height) x TEXTURE_VECTOR_SIZE 32F matrix
+		 **/
+		void GetTextureVectors(IplImage * pImg, IplImage * pImgFloat, CvMat * pTextureMat);
 		
+		/**
+		 * Histogram of the (2*radius+1)^2 window around each pixel, per channel.
+		 * The window is mirrored at the image borders.
+		 * @param pImg 8 bit image
+		 * @param pHistogram [out] (width*height) x (channels*nBins) 32F matrix
+		 * @param nBins number of bins per channel
+		 **/
 		void CalcHistogram(IplImage * pImg, CvMat * pHistogram, int nBins);
 		
 		bool GetChannels(CvMat * pMergedMat, CvMat * pChannels[], int nTotalChans, int nExtractChans);
 		bool DoPCA(CvMat * pMat, CvMat * pResultMat, int nSize, int nExpectedSize); 
-		
-		//bool CFeatureExtraction::MergeMatrices(CvMat * pMatrix1, CvMat * pMatrix2, CvMat * pMatrix3, CvMat * pResultMat);
-		bool MergeMatrices(CvMat * pMatrix1, CvMat * pMatrix2, CvMat * pResultMat);
+
+		/**
+		 * The nExpectedSize dominant eigen vectors of a covariance matrix
+		 * @param pCovMat nSize x nSize 32F matrix (destroyed)
+		 * @param pEigenVecs [out] nSize x nExpectedSize 32F matrix, a vector per column
+		 **/
+		void GetEigenVectors(CvMat * pCovMat, CvMat * pEigenVecs);
+
+		/**
+		 * pResultMat = pMat * pEigenVecs, by blocks of rows on several threads
+		 **/
+		void Project(CvMat * pMat, CvMat * pEigenVecs, CvMat * pResultMat);
+
+		/**
+		 * Pick one random row out of each run of 1/dRate consecutive rows
+		 * @return a new (rows*dRate) x cols matrix
+		 **/
+		CvMat * SampleRows(CvMat * pMat, double dRate, unsigned int nSeed);
+
+		/**
+		 * The largest principal angle (in degrees) between the spans of two
+		 * sets of orthonormal column vectors
+		 **/
+		double GetSubspaceAngle(CvMat * pVecs1, CvMat * pVecs2);
+
+		/**
+		 * The side of the tiles that keeps the extraction under m_params.nMemoryLimit,
+		 * or 0 if the whole image fits
+		 **/
+		int GetTileSize();
+
+		/**
+		 * Tiled extraction, first pass: the eigen vectors, from the covariances 
+		 * accumulated over the tiles
+		 **/
+		void AccumulateTiles();
+
+		/**
+		 * Tiled extraction, second pass: the features of each tile are computed 
+		 * again and projected on the eigen vectors
+		 **/
+		void ProjectTiles(CFeatureSink * pSink);
+
+		/**
+		 * The Lab and texture vectors of the pixels of a tile.
+		 * They are computed on the tile extended by m_nHalo pixels, so they 
+		 * are the same as the ones computed on the whole image
+		 * @param pColorMat [out] (tile pixels) x COLOR_CHANNEL_NUM 32F matrix
+		 * @param pTextureMat [out] (tile pixels) x TEXTURE_VECTOR_SIZE 32F matrix
+		 **/
+		void GetTileVectors(CvRect tile, CvMat * pColorMat, CvMat * pTextureMat);
 
 	protected:
 		
@@ -58,13 +194,24 @@ class CFeatureExtraction
 		int			m_nHeight;
 		int			m_nChannels;
 
-		CvMat *		m_pColorChannelsArr[COLOR_CHANNEL_NUM];
-		CvMat *		m_pTextureChannelsArr[TEXTURE_CHANNEL_NUM];
-		
-		CvMat * 	m_pColorChannels;
-		CvMat * 	m_pTextureChannels;
-		
+		SFeatureParams	m_params;
+
+		CGaborFilterBank *	m_pGaborBank;
+
+		// Tiled mode (m_nTileSize > 0), the halo is the reach of the texture features
+		int			m_nTileSize;
+		int			m_nHalo;
+
+		// Tiled mode, the eigen vectors of the first pass (NULL before it)
+		CvMat *		m_pColorVecs;
+		CvMat *		m_pTextureVecs;
+
+		// NULL until run() computes them
 		CvMat * 	m_pPrincipalChannels;
+
+		// Column views on m_pPrincipalChannels
+		CvMat		m_colorChannels;
+		CvMat		m_textureChannels;
 		
 };
 
@@ -0,0 +1,456 @@
+#include "GaborFilterBank.h"
+#include "GaborKernelCache.h"
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+inline double round2( double d )
+{
+	return floor( d + 0.5 );
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The size of the worker team: the threads whose scratch buffers (dWorkerBytes each)
+ * fit in what dUsedBytes leaves of the budget, at least one
+ **/
+static int GetWorkers(double dWorkerBytes, double dUsedBytes)
+{
+	int nThreads = 1;
+#ifdef _OPENMP
+	nThreads = omp_get_max_threads();
+#endif
+	double dFit = (GABOR_MEMORY_BUDGET - dUsedBytes) / dWorkerBytes;
+	return (dFit < 1) ? 1 : (int)MIN(dFit, (double)nThreads);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CGaborFilterBank::CGaborFilterBank(int nMode, int nSepMaxRank, double dSepMaxError)
+:m_nMode(nMode),m_nSepMaxRank(nSepMaxRank),m_dSepMaxError(dSepMaxError)
+{
+	double freq = GABOR_BASE_FREQUENCY;
+	int freq_steps = GABOR_FREQUENCIES_NUM;
+	int ori_count = GABOR_ORIENTATIONS_NUM;
+	double ori_space = PI/ori_count;
+	int idx = 0;
+
+	int i,j;
+	for (i=0;i<freq_steps;i++)
+	{
+		double bw = (2 * freq) / 3;
+		double sx = round2(0.5 / PI / pow(bw,2));
+		double sy = round2(0.5 * log(2.0) / pow(PI,2.0) / pow(freq,2.0) / (pow(tan(ori_space / 2),2.0)));
+
+		for (j=0;j<ori_count;j++)
+		{
+			double ori = j*ori_space;
+			m_pSeparable[idx] = NULL;
+			m_pSpectra[idx] = NULL;
+			m_pFilters[idx++] = CGaborKernelCache::Get(ori, freq, sx, sy);
+		}
+		freq /= 2;
+	}
+
+	if (m_nMode == GABOR_MODE_SEPARABLE)
+		CreateSeparable();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CGaborFilterBank::~CGaborFilterBank()
+{
+	// The filters belong to the kernel cache, only their separable kernels and spectra are ours
+	ReleaseSeparable();
+	ReleaseSpectra();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::SetMode(int nMode)
+{
+	m_nMode = nMode;
+	if (m_nMode == GABOR_MODE_SEPARABLE && m_pSeparable[0] == NULL)
+		CreateSeparable();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::SetSeparable(int nMaxRank, double dMaxError)
+{
+	if (nMaxRank == m_nSepMaxRank && dMaxError == m_dSepMaxError)
+		return;
+
+	m_nSepMaxRank = nMaxRank;
+	m_dSepMaxError = dMaxError;
+
+	// Decompose again with the new setting, now or when the mode is selected
+	ReleaseSeparable();
+	if (m_nMode == GABOR_MODE_SEPARABLE)
+		CreateSeparable();
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::CreateSeparable()
+{
+	int nTotalRank = 0;
+	double dMaxError = 0;
+	for (int idx=0;idx<GABOR_SIZE;idx++)
+	{
+		if (m_pSeparable[idx] == NULL)
+			m_pSeparable[idx] = new CvGaborSeparable();
+		nTotalRank += m_pFilters[idx]->CreateSeparable(m_nSepMaxRank, m_dSepMaxError, m_pSeparable[idx]);
+		dMaxError = MAX(dMaxError, m_pSeparable[idx]->GetError());
+	}
+	printf("\tSeparable Gabor kernels: average rank=%.2f, maximal relative kernel error=%g\n", 
+		(double)nTotalRank / GABOR_SIZE, dMaxError);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::ReleaseSeparable()
+{
+	for (int idx=0;idx<GABOR_SIZE;idx++)
+	{
+		delete m_pSeparable[idx];
+		m_pSeparable[idx] = NULL;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborFilterBank::Apply(IplImage * pGrayImg, CvMat * pGaborMat)
+{
+	if (m_nMode == GABOR_MODE_SPATIAL)
+		return ApplySpatial(pGrayImg, pGaborMat);
+
+	if (m_nMode == GABOR_MODE_OCTAVE)
+		return ApplyOctave(pGrayImg, pGaborMat);
+
+	if (m_nMode == GABOR_MODE_SEPARABLE)
+		return ApplySeparable(pGrayImg, pGaborMat);
+
+	return ApplyFFT(pGrayImg, pGaborMat);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+int CGaborFilterBank::GetHalo()
+{
+	int nHalo = 0;
+
+	if (m_nMode == GABOR_MODE_OCTAVE) {
+		// The base frequency filters run on a level with 2^(levels-1) times larger pixels,
+		// and each cvPyrDown adds its own 5x5 support
+		int nScale = 1 << (GABOR_FREQUENCIES_NUM - 1);
+		for (int i=0;i<GABOR_ORIENTATIONS_NUM;i++)
+		{
+			CvMat * pKernel = m_pFilters[i]->get_matrix(CV_GABOR_REAL);
+			nHalo = MAX(nHalo, MAX(pKernel->rows, pKernel->cols) / 2 + 1);
+		}
+		return nHalo * nScale + 2 * nScale;
+	}
+
+	for (int i=0;i<GABOR_SIZE;i++)
+	{
+		CvMat * pKernel = m_pFilters[i]->get_matrix(CV_GABOR_REAL);
+		nHalo = MAX(nHalo, MAX(pKernel->rows, pKernel->cols) / 2 + 1);
+	}
+	return nHalo;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborFilterBank::ApplySpatial(IplImage * pGrayImg, CvMat * pGaborMat)
+{
+	int nStride = pGaborMat->step / sizeof(float);
+	int nWorkers = GetWorkers(2.0 * pGrayImg->width * pGrayImg->height * sizeof(float), 0);
+
+	// Each worker has its own real/imaginary response buffers, 
+	// and writes the magnitude straight into the filter's column of the result matrix
+#pragma omp parallel num_threads(nWorkers)
+	{
+		CvMat * pRe = cvCreateMat(pGrayImg->height, pGrayImg->width, CV_32F);
+		CvMat * pIm = cvCreateMat(pGrayImg->height, pGrayImg->width, CV_32F);
+
+#pragma omp for schedule(dynamic)
+		for (int idx=0;idx<GABOR_SIZE;idx++)
+			m_pFilters[idx]->ApplyMagnitude(pGrayImg, pGaborMat->data.fl + idx, nStride, pRe, pIm);
+
+		cvReleaseMat(&pIm);
+		cvReleaseMat(&pRe);
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborFilterBank::ApplyFFT(IplImage * pGrayImg, CvMat * pGaborMat)
+{
+	int w = pGrayImg->width;
+	int h = pGrayImg->height;
+	int nStride = pGaborMat->step / sizeof(float);
+	int idx;
+
+	// Pad the image (replicating the border, like cvFilter2D does)
+	// so that the largest kernel in the bank fits around its anchor.
+	int nPadTop = 0, nPadLeft = 0, nPadBottom = 0, nPadRight = 0;
+	for (idx=0;idx<GABOR_SIZE;idx++)
+	{
+		CvMat * pReal = m_pFilters[idx]->get_transposed_matrix(CV_GABOR_REAL);
+		CvPoint anchor = m_pFilters[idx]->GetAnchor();
+
+		nPadTop = MAX(nPadTop, anchor.y);
+		nPadLeft = MAX(nPadLeft, anchor.x);
+		nPadBottom = MAX(nPadBottom, pReal->rows - 1 - anchor.y);
+		nPadRight = MAX(nPadRight, pReal->cols - 1 - anchor.x);
+	}
+
+	int nDftWidth = cvGetOptimalDFTSize(w + nPadLeft + nPadRight);
+	int nDftHeight = cvGetOptimalDFTSize(h + nPadTop + nPadBottom);
+
+	// Build the (zero padded) complex image and transform it once
+	IplImage * pPadded = cvCreateImage(cvSize(w + nPadLeft + nPadRight, h + nPadTop + nPadBottom), IPL_DEPTH_32F, 1);
+	cvCopyMakeBorder(pGrayImg, pPadded, cvPoint(nPadLeft, nPadTop), IPL_BORDER_REPLICATE);
+
+	CvMat * pImgSpectrum = cvCreateMat(nDftHeight, nDftWidth, CV_32FC2);
+
+	cvSetZero(pImgSpectrum);
+	for (int y=0;y<pPadded->height;y++)
+	{
+		float * pSrc = (float *) (pPadded->imageData + y*pPadded->widthStep);
+		float * pDst = (float *) (pImgSpectrum->data.ptr + y*pImgSpectrum->step);
+		for (int x=0;x<pPadded->width;x++)
+			pDst[2*x] = pSrc[x];
+	}
+	int nImgRows = pPadded->height;
+	cvReleaseImage(&pPadded);
+
+	cvDFT(pImgSpectrum, pImgSpectrum, CV_DXT_FORWARD, nImgRows);
+
+	// The kernel spectra depend only on the DFT size (the padding is the same for every image), 
+	// so keep them for the next calls (e.g. the next tiles) while they fit in half of the budget
+	double dSpectrumBytes = (double)nDftWidth * nDftHeight * 2 * sizeof(float);
+	bool fKeepSpectra = (GABOR_SIZE * dSpectrumBytes <= GABOR_MEMORY_BUDGET / 2);
+	if (m_pSpectra[0] != NULL && 
+		(!fKeepSpectra || m_pSpectra[0]->rows != nDftHeight || m_pSpectra[0]->cols != nDftWidth))
+		ReleaseSpectra();
+
+	if (fKeepSpectra && m_pSpectra[0] == NULL) {
+		for (idx=0;idx<GABOR_SIZE;idx++)
+			m_pSpectra[idx] = cvCreateMat(nDftHeight, nDftWidth, CV_32FC2);
+
+#pragma omp parallel for schedule(dynamic)
+		for (idx=0;idx<GABOR_SIZE;idx++)
+			CreateSpectrum(idx, nPadTop, nPadLeft, m_pSpectra[idx]);
+	}
+
+	// The image spectrum is shared, each worker has its own product (which holds 
+	// the kernel spectrum first, when they are not kept), as many as fit the budget
+	int nWorkers = GetWorkers(dSpectrumBytes, fKeepSpectra ? GABOR_SIZE * dSpectrumBytes : 0);
+#pragma omp parallel num_threads(nWorkers)
+	{
+		CvMat * pProduct = cvCreateMat(nDftHeight, nDftWidth, CV_32FC2);
+
+#pragma omp for schedule(dynamic)
+		for (idx=0;idx<GABOR_SIZE;idx++)
+		{
+			CvMat * pSpectrum = m_pSpectra[idx];
+			if (!fKeepSpectra) {
+				CreateSpectrum(idx, nPadTop, nPadLeft, pProduct);
+				pSpectrum = pProduct;
+			}
+
+			// Correlation is a multiplication by the conjugate spectrum (element by element, 
+			// so the product may overwrite the kernel spectrum)
+			cvMulSpectrums(pImgSpectrum, pSpectrum, pProduct, CV_DXT_MUL_CONJ);
+			cvDFT(pProduct, pProduct, CV_DXT_INV_SCALE, h);
+
+			// The magnitude is the modulus of the complex response
+			float * pMatPos = pGaborMat->data.fl + idx;
+			for (int y=0;y<h;y++)
+			{
+				float * pRes = (float *) (pProduct->data.ptr + y*pProduct->step);
+				for (int x=0;x<w;x++)
+				{
+					float re = pRes[2*x];
+					float im = pRes[2*x+1];
+					*pMatPos = sqrt(re*re + im*im);
+					pMatPos += nStride;
+				}
+			}
+		}
+
+		cvReleaseMat(&pProduct);
+	}
+
+	cvReleaseMat(&pImgSpectrum);
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::CreateSpectrum(int idx, int nPadTop, int nPadLeft, CvMat * pSpectrum)
+{
+	CvMat * pReal = m_pFilters[idx]->get_transposed_matrix(CV_GABOR_REAL);
+	CvMat * pImag = m_pFilters[idx]->get_transposed_matrix(CV_GABOR_IMAG);
+	CvPoint anchor = m_pFilters[idx]->GetAnchor();
+	int nOffsetY = nPadTop - anchor.y;
+	int nOffsetX = nPadLeft - anchor.x;
+
+	// Real part of the filter in the real channel, imaginary part in the imaginary one
+	cvSetZero(pSpectrum);
+	for (int r=0;r<pReal->rows;r++)
+	{
+		float * pDst = (float *) (pSpectrum->data.ptr + (r + nOffsetY)*pSpectrum->step) + 2*nOffsetX;
+		for (int c=0;c<pReal->cols;c++)
+		{
+			pDst[2*c] = pReal->data.fl[r*pReal->cols + c];
+			pDst[2*c+1] = pImag->data.fl[r*pImag->cols + c];
+		}
+	}
+	cvDFT(pSpectrum, pSpectrum, CV_DXT_FORWARD, nOffsetY + pReal->rows);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborFilterBank::ReleaseSpectra()
+{
+	for (int idx=0;idx<GABOR_SIZE;idx++)
+	{
+		if (m_pSpectra[idx] != NULL)
+			cvReleaseMat(&m_pSpectra[idx]);
+		m_pSpectra[idx] = NULL;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborFilterBank::ApplyOctave(IplImage * pGrayImg, CvMat * pGaborMat)
+{
+	int w = pGrayImg->width;
+	int h = pGrayImg->height;
+	int nStride = pGaborMat->step / sizeof(float);
+	int i;
+
+	// Level i of the pyramid matches the frequency band i
+	IplImage * pPyramid[GABOR_FREQUENCIES_NUM];
+	pPyramid[0] = pGrayImg;
+	for (i=1;i<GABOR_FREQUENCIES_NUM;i++)
+	{
+		pPyramid[i] = cvCreateImage(cvSize((pPyramid[i-1]->width+1)/2, (pPyramid[i-1]->height+1)/2), IPL_DEPTH_32F, 1);
+		cvPyrDown(pPyramid[i-1], pPyramid[i], CV_GAUSSIAN_5x5);
+	}
+
+	double dWorkerBytes = 2.0 * w * h * sizeof(float);
+	if (GABOR_FREQUENCIES_NUM > 1)
+		dWorkerBytes += (double)pPyramid[1]->width * pPyramid[1]->height * sizeof(float);
+	int nWorkers = GetWorkers(dWorkerBytes, 0);
+
+#pragma omp parallel num_threads(nWorkers)
+	{
+		// Scratch buffers for the largest level, smaller levels use headers over the same data
+		CvMat * pRe = cvCreateMat(h, w, CV_32F);
+		CvMat * pIm = cvCreateMat(h, w, CV_32F);
+		float * pLevelMag = NULL;
+		if (GABOR_FREQUENCIES_NUM > 1)
+			pLevelMag = new float[pPyramid[1]->width * pPyramid[1]->height];
+
+#pragma omp for schedule(dynamic)
+		for (int idx=0;idx<GABOR_SIZE;idx++)
+		{
+			int nLevel = idx / GABOR_ORIENTATIONS_NUM;
+			int nOrientation = idx % GABOR_ORIENTATIONS_NUM;
+
+			// The base frequency filter with the same orientation
+			CvGabor * pFilter = m_pFilters[nOrientation];
+			float * pMatPos = pGaborMat->data.fl + idx;
+
+			if (nLevel == 0) {
+				pFilter->ApplyMagnitude(pGrayImg, pMatPos, nStride, pRe, pIm);
+				continue;
+			}
+
+			IplImage * pLevelImg = pPyramid[nLevel];
+			int lw = pLevelImg->width;
+			int lh = pLevelImg->height;
+			CvMat re, im;
+			cvInitMatHeader(&re, lh, lw, CV_32F, pRe->data.fl);
+			cvInitMatHeader(&im, lh, lw, CV_32F, pIm->data.fl);
+
+			pFilter->ApplyMagnitude(pLevelImg, pLevelMag, 1, &re, &im);
+
+			// Bilinear upsampling, pixel x of the level lies on pixel x*2^nLevel of the image
+			float fScale = 1.0f / (1 << nLevel);
+			for (int y=0;y<h;y++)
+			{
+				float fy = y * fScale;
+				int y0 = MIN((int)fy, lh - 1);
+				int y1 = MIN(y0 + 1, lh - 1);
+				float wy = fy - y0;
+				const float * pRow0 = pLevelMag + y0*lw;
+				const float * pRow1 = pLevelMag + y1*lw;
+
+				for (int x=0;x<w;x++)
+				{
+					float fx = x * fScale;
+					int x0 = MIN((int)fx, lw - 1);
+					int x1 = MIN(x0 + 1, lw - 1);
+					float wx = fx - x0;
+
+					float top = pRow0[x0] + wx * (pRow0[x1] - pRow0[x0]);
+					float bottom = pRow1[x0] + wx * (pRow1[x1] - pRow1[x0]);
+					*pMatPos = top + wy * (bottom - top);
+					pMatPos += nStride;
+				}
+			}
+		}
+
+		delete [] pLevelMag;
+		cvReleaseMat(&pIm);
+		cvReleaseMat(&pRe);
+	}
+
+	for (i=1;i<GABOR_FREQUENCIES_NUM;i++)
+		cvReleaseImage(&pPyramid[i]);
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborFilterBank::ApplySeparable(IplImage * pGrayImg, CvMat * pGaborMat)
+{
+	int nStride = pGaborMat->step / sizeof(float);
+	int idx;
+
+	// The kernels were decomposed when the mode was set
+	if (m_pSeparable[0] == NULL)
+		CreateSeparable();
+
+	int nWorkers = GetWorkers(3.0 * pGrayImg->width * pGrayImg->height * sizeof(float), 0);
+#pragma omp parallel num_threads(nWorkers)
+	{
+		CvMat * pRe = cvCreateMat(pGrayImg->height, pGrayImg->width, CV_32F);
+		CvMat * pIm = cvCreateMat(pGrayImg->height, pGrayImg->width, CV_32F);
+		CvMat * pTmp = cvCreateMat(pGrayImg->height, pGrayImg->width, CV_32F);
+
+#pragma omp for schedule(dynamic)
+		for (idx=0;idx<GABOR_SIZE;idx++)
+			m_pFilters[idx]->ApplyMagnitudeSeparable(m_pSeparable[idx], pGrayImg, pGaborMat->data.fl + idx, nStride, pRe, pIm, pTmp);
+
+		cvReleaseMat(&pTmp);
+		cvReleaseMat(&pIm);
+		cvReleaseMat(&pRe);
+	}
+
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
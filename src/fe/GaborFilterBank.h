@@ -0,0 +1,112 @@
+#ifndef __GABOR_FILTER_BANK_H__
+#define __GABOR_FILTER_BANK_H__
+
+#include <cv.h>
+#include <cxcore.h>
+
+#include "FeatureExtraction.h"
+#include "cvgabor.h"
+
+// The scratch memory (in bytes) of the bank: the workers are limited to the ones whose
+// buffers fit in it (but one always runs), and the kernel spectra of GABOR_MODE_FFT 
+// are kept between the calls while they fit in half of it
+#define GABOR_MEMORY_BUDGET		(256 * 1024 * 1024)
+
+/**
+ * The GABOR_FREQUENCIES_NUM x GABOR_ORIENTATIONS_NUM bank of Gabor filters
+ * used for the texture features.
+ * The magnitude response of filter i is written into column i of the result matrix.
+ **/
+class CGaborFilterBank
+{
+	public:
+		/**
+		 * @param nSepMaxRank, dSepMaxError the approximation of GABOR_MODE_SEPARABLE (see SetSeparable)
+		 **/
+		CGaborFilterBank(int nMode = GABOR_MODE_FFT, int nSepMaxRank = 3, double dSepMaxError = 0.01);
+		virtual ~CGaborFilterBank();
+
+		/**
+		 * Apply the whole bank on a grayscale image
+		 * @param pGrayImg a 32F single channel image
+		 * @param pGaborMat [out] (width*height) x GABOR_SIZE 32F matrix
+		 **/
+		bool Apply(IplImage * pGrayImg, CvMat * pGaborMat);
+
+		void SetMode(int nMode);
+		int GetMode()				{ return m_nMode; }
+
+		/**
+		 * Set the approximation of GABOR_MODE_SEPARABLE
+		 * @param nMaxRank the maximal number of separable terms per kernel
+		 * @param dMaxError stop adding terms when the relative kernel error is below it
+		 **/
+		void SetSeparable(int nMaxRank, double dMaxError);
+
+		/**
+		 * How far (in pixels) the response at a pixel depends on its neighbourhood,
+		 * in the current mode
+		 **/
+		int GetHalo();
+
+	protected:
+
+		/**
+		 * Convolve with each filter in the image domain (cvFilter2D)
+		 **/
+		bool ApplySpatial(IplImage * pGrayImg, CvMat * pGaborMat);
+
+		/**
+		 * Transform the image once, and multiply its spectrum by the spectrum
+		 * of each (complex) filter
+		 **/
+		bool ApplyFFT(IplImage * pGrayImg, CvMat * pGaborMat);
+
+		/**
+		 * The spectrum of filter idx, placed so its anchor is at (nPadLeft, nPadTop)
+		 * @param pSpectrum [out] 32FC2 matrix of the DFT size
+		 **/
+		void CreateSpectrum(int idx, int nPadTop, int nPadLeft, CvMat * pSpectrum);
+
+		void ReleaseSpectra();
+
+		/**
+		 * Every frequency band is half the previous one, so apply the base frequency
+		 * filters on each level of a Gaussian pyramid instead, 
+		 * and upsample the magnitudes back to the full resolution.
+		 * This only approximates the direct bank: the envelope sizes (sx, sy) of each band
+		 * are rounded to whole pixels, so they do not exactly double with each level, 
+		 * and the pyramid smoothing and upsampling add their own error
+		 * (-bench gabor reports it per level)
+		 **/
+		bool ApplyOctave(IplImage * pGrayImg, CvMat * pGaborMat);
+
+		/**
+		 * Convolve with a low rank sum of separable kernels
+		 **/
+		bool ApplySeparable(IplImage * pGrayImg, CvMat * pGaborMat);
+
+		/**
+		 * Decompose the filters for GABOR_MODE_SEPARABLE, once for each setting
+		 **/
+		void CreateSeparable();
+
+		void ReleaseSeparable();
+
+	protected:
+
+		// Shared filters, owned by CGaborKernelCache
+		CvGabor *	m_pFilters[GABOR_SIZE];
+		int			m_nMode;
+
+		int			m_nSepMaxRank;
+		double		m_dSepMaxError;
+
+		// The separable kernels of the filters, owned by the bank (NULL until needed)
+		CvGaborSeparable *	m_pSeparable[GABOR_SIZE];
+
+		// The spectra of the filters for the last DFT size (NULL when they do not fit the budget)
+		CvMat *		m_pSpectra[GABOR_SIZE];
+};
+
+#endif // __GABOR_FILTER_BANK_H__
@@ -0,0 +1,171 @@
+#include "GaborKernelCache.h"
+
+#include <stdio.h>
+
+#define GABOR_CACHE_MAGIC	0x4B424147	// "GABK"
+#define GABOR_CACHE_VERSION	1
+
+CGaborKernelCache::FilterMap CGaborKernelCache::m_filters;
+bool CGaborKernelCache::m_fDirty = false;
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborKernelCache::SKey::operator<(const SKey& k) const
+{
+	if (m_orientation != k.m_orientation)
+		return m_orientation < k.m_orientation;
+	if (m_freq != k.m_freq)
+		return m_freq < k.m_freq;
+	if (m_sx != k.m_sx)
+		return m_sx < k.m_sx;
+	return m_sy < k.m_sy;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+CvGabor * CGaborKernelCache::Get(float orientation, float freq, float sx, float sy)
+{
+	CvGabor * pGabor;
+	SKey key(orientation, freq, sx, sy);
+
+#pragma omp critical(gabor_kernel_cache)
+	{
+		FilterMap::iterator iter = m_filters.find(key);
+		if (iter != m_filters.end()) {
+			pGabor = iter->second;
+		}
+		else {
+			pGabor = new CvGabor(orientation, freq, sx, sy);
+			m_filters[key] = pGabor;
+			m_fDirty = true;
+		}
+	}
+
+	return pGabor;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborKernelCache::Load(const char * strPath)
+{
+	FILE * fp = fopen(strPath, "rb");
+	if (fp == NULL)
+		return false;
+
+	int header[3];
+	if (fread(header, sizeof(int), 3, fp) != 3 ||
+		header[0] != GABOR_CACHE_MAGIC ||
+		header[1] != GABOR_CACHE_VERSION) {
+		fclose(fp);
+		return false;
+	}
+
+	// Read the whole file before touching the cache, so a bad file adds nothing
+	FilterMap loaded;
+	bool fResult = (header[2] >= 0);
+	for (int i = 0; i < header[2] && fResult; i++) {
+		float params[4];
+		int size[2];
+		if (fread(params, sizeof(float), 4, fp) != 4 ||
+			fread(size, sizeof(int), 2, fp) != 2) {
+			fResult = false;
+			break;
+		}
+
+		// A kernel that does not match its parameters is from a stale or corrupt file
+		CvSize expected = CvGabor::CalcKernelSize(params[0], params[2], params[3]);
+		if (size[0] != expected.height || size[1] != expected.width) {
+			fResult = false;
+			break;
+		}
+
+		CvMat * pReal = cvCreateMat(size[0], size[1], CV_32F);
+		CvMat * pImag = cvCreateMat(size[0], size[1], CV_32F);
+		int nElements = size[0] * size[1];
+		if (fread(pReal->data.fl, sizeof(float), nElements, fp) != (size_t)nElements ||
+			fread(pImag->data.fl, sizeof(float), nElements, fp) != (size_t)nElements) {
+			cvReleaseMat(&pReal);
+			cvReleaseMat(&pImag);
+			fResult = false;
+			break;
+		}
+
+		SKey key(params[0], params[1], params[2], params[3]);
+		if (loaded.find(key) == loaded.end()) {
+			loaded[key] = new CvGabor(params[0], params[1], params[2], params[3], pReal, pImag);
+		}
+		else {
+			cvReleaseMat(&pReal);
+			cvReleaseMat(&pImag);
+		}
+	}
+	fclose(fp);
+
+	if (!fResult) {
+		for (FilterMap::iterator iter = loaded.begin(); iter != loaded.end(); iter++)
+			delete iter->second;
+		return false;
+	}
+
+#pragma omp critical(gabor_kernel_cache)
+	{
+		for (FilterMap::iterator iter = loaded.begin(); iter != loaded.end(); iter++) {
+			if (m_filters.find(iter->first) == m_filters.end())
+				m_filters[iter->first] = iter->second;
+			else
+				delete iter->second;
+		}
+		m_fDirty = false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+bool CGaborKernelCache::Save(const char * strPath)
+{
+	FILE * fp = fopen(strPath, "wb");
+	if (fp == NULL)
+		return false;
+
+	bool fResult = true;
+#pragma omp critical(gabor_kernel_cache)
+	{
+		int header[3] = { GABOR_CACHE_MAGIC, GABOR_CACHE_VERSION, (int)m_filters.size() };
+		fResult = (fwrite(header, sizeof(int), 3, fp) == 3);
+
+		for (FilterMap::iterator iter = m_filters.begin(); iter != m_filters.end() && fResult; iter++) {
+			float params[4] = { iter->first.m_orientation, iter->first.m_freq,
+								iter->first.m_sx, iter->first.m_sy };
+			CvMat * pReal = iter->second->get_matrix(CV_GABOR_REAL);
+			CvMat * pImag = iter->second->get_matrix(CV_GABOR_IMAG);
+			int size[2] = { pReal->rows, pReal->cols };
+			int nElements = size[0] * size[1];
+
+			fResult = fwrite(params, sizeof(float), 4, fp) == 4 &&
+					fwrite(size, sizeof(int), 2, fp) == 2 &&
+					fwrite(pReal->data.fl, sizeof(float), nElements, fp) == (size_t)nElements &&
+					fwrite(pImag->data.fl, sizeof(float), nElements, fp) == (size_t)nElements;
+		}
+	}
+
+	fclose(fp);
+	if (fResult)
+		m_fDirty = false;
+	return fResult;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+
+void CGaborKernelCache::Clear()
+{
+#pragma omp critical(gabor_kernel_cache)
+	{
+		for (FilterMap::iterator iter = m_filters.begin(); iter != m_filters.end(); iter++)
+			delete iter->second;
+		m_filters.clear();
+		m_fDirty = false;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
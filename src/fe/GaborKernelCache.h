@@ -0,0 +1,67 @@
+#ifndef __GABOR_KERNEL_CACHE_H__
+#define __GABOR_KERNEL_CACHE_H__
+
+#include <map>
+
+#include "cvgabor.h"
+
+/**
+ * A process-wide bank of Gabor filters, keyed by (orientation, frequency, sx, sy).
+ * Each real/imaginary kernel pair is created once, and the filters are then shared
+ * (read only) by all the users and threads.
+ * The bank can be saved to a small binary file, and loaded on the next run.
+ **/
+class CGaborKernelCache
+{
+	public:
+		/**
+		 * Get the filter with the given parameters, creating it if needed.
+		 * The cache owns the filter.
+		 **/
+		static CvGabor * Get(float orientation, float freq, float sx, float sy);
+
+		/**
+		 * Add the kernels saved by Save() to the cache
+		 * @return false if the file could not be read or a kernel does not have
+		 * the size of its parameters; nothing is added then
+		 **/
+		static bool Load(const char * strPath);
+
+		/**
+		 * Save all the kernels in the cache
+		 **/
+		static bool Save(const char * strPath);
+
+		/**
+		 * Were kernels created since the last Load()/Save()
+		 **/
+		static bool IsDirty()	{ return m_fDirty; }
+
+		/**
+		 * Release all the filters
+		 **/
+		static void Clear();
+
+	protected:
+
+		class SKey
+		{
+		public:
+			SKey(float orientation, float freq, float sx, float sy)
+				:m_orientation(orientation),m_freq(freq),m_sx(sx),m_sy(sy) {}
+
+			bool operator<(const SKey& k) const;
+
+			float m_orientation;
+			float m_freq;
+			float m_sx;
+			float m_sy;
+		};
+
+		typedef std::map<SKey, CvGabor*> FilterMap;
+
+		static FilterMap	m_filters;
+		static bool			m_fDirty;
+};
+
+#endif // __GABOR_KERNEL_CACHE_H__
@@ -19,10 +19,17 @@
  ***************************************************************************/
 #include "cvgabor.h"
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define CV_GABOR_SSE
+#endif
+
 CvGabor::~CvGabor()
 {
 cvReleaseMat( &Real );
 cvReleaseMat( &Imag );
+cvReleaseMat( &RealT );
+cvReleaseMat( &ImagT );
 }
 
  CvGabor::CvGabor(float orientation, float freq, float sx, float sy)
@@ -31,6 +38,37 @@ cvReleaseMat( &Imag );
     Init(orientation, freq, sx, sy);
     
 }
+
+/*
+    \fn CvGabor::CvGabor(float orientation, float freq, float sx, float sy, CvMat *pReal, CvMat *pImag)
+Create a gabor from kernels that were already computed (e.g. loaded from a file)
+
+Parameters:
+	pReal, pImag	the REAL and IMAG kernels, as returned by get_matrix(). The gabor takes their ownership.
+ */
+ CvGabor::CvGabor(float orientation, float freq, float sx, float sy, CvMat *pReal, CvMat *pImag)
+{
+	m_orientation = orientation;
+	m_frequency = freq;
+	m_sx = sx;
+	m_sy = sy;
+	m_cutOff = 2.0;
+
+	m_sizeX = pReal->cols;
+	m_sizeY = pReal->rows;
+	m_halfSizeX = (m_sizeX - 1) / 2.0f;
+	m_halfSizeY = (m_sizeY - 1) / 2.0f;
+
+	Real = pReal;
+	Imag = pImag;
+	RealT = cvCreateMat(m_sizeX, m_sizeY, CV_32F);
+	ImagT = cvCreateMat(m_sizeX, m_sizeY, CV_32F);
+	cvTranspose(Real, RealT);
+	cvTranspose(Imag, ImagT);
+
+	bInitialised = TRUE;
+	bKernel = TRUE;
+}
 /*
     \fn CvGabor::IsInit()
 Determine the gabor is initilised or not
@@ -70,61 +108,86 @@ long CvGabor::CalcKernelSize()
        return 0;
     }
     else {
+		CalcHalfSize(m_orientation, m_sx, m_sy, m_cutOff, &m_halfSizeX, &m_halfSizeY);
+    }
+    return 0;
+}
 
-		CvMat* pRotationMat = cvCreateMat(2,2,CV_32F);
-		pRotationMat->data.fl[0] = cos(m_orientation);
-		pRotationMat->data.fl[1] = sin(m_orientation);
-		pRotationMat->data.fl[2] = -sin(m_orientation);
-		pRotationMat->data.fl[3] = cos(m_orientation);
-		
 
-		float unrotatedHalfSizeX = ceil(m_cutOff * sqrt(m_sx));
-		float unrotatedHalfSizeY = ceil(m_cutOff * sqrt(m_sy));
-		
-		CvMat* pBoundingBox = cvCreateMat(4,2,CV_32F);
-		pBoundingBox->data.fl[0] = unrotatedHalfSizeX;
-		pBoundingBox->data.fl[1] = unrotatedHalfSizeY;
-		pBoundingBox->data.fl[2] = -unrotatedHalfSizeX;
-		pBoundingBox->data.fl[3] = unrotatedHalfSizeY;
-		pBoundingBox->data.fl[4] = unrotatedHalfSizeX;
-		pBoundingBox->data.fl[5] = -unrotatedHalfSizeY;
-		pBoundingBox->data.fl[6] = -unrotatedHalfSizeX;
-		pBoundingBox->data.fl[7] = -unrotatedHalfSizeY;
-		
-		CvMat* pRotatedBoundingBox = cvCreateMat(4,2,CV_32F);
-		CvMat* pRotationMatTP = cvCreateMat(2,2,CV_32F);
-		cvTranspose(pRotationMat, pRotationMatTP);
-		cvMatMul(pBoundingBox, pRotationMatTP, pRotatedBoundingBox);
-		
-		int i=0, j=0;
-		float halfSizeX = pRotatedBoundingBox->data.fl[i*2+j];
-		for (i=1;i<4;i++)
-		{
-			float val = pRotatedBoundingBox->data.fl[i*2+j];
-			if (val > halfSizeX)
-				halfSizeX = val;
-		}
-		
+/*!
+    \fn CvGabor::CalcKernelSize(float orientation, float sx, float sy)
+The size of the kernels of a gabor with these parameters, without creating it
+(e.g. to check kernels that were loaded from a file)
+
+Returns:
+	The width and height of the REAL and IMAG kernels
+ */
+CvSize CvGabor::CalcKernelSize(float orientation, float sx, float sy)
+{
+	float halfSizeX, halfSizeY;
+	CalcHalfSize(orientation, sx, sy, 2.0, &halfSizeX, &halfSizeY);
+	return cvSize((int) floor(halfSizeX*2+1), (int) floor(halfSizeY*2+1));
+}
+
+
+/*!
+    \fn CvGabor::CalcHalfSize(float orientation, float sx, float sy, float cutOff, float *pHalfSizeX, float *pHalfSizeY)
+The half sizes of the bounding box of the rotated kernel
+ */
+void CvGabor::CalcHalfSize(float orientation, float sx, float sy, float cutOff, float *pHalfSizeX, float *pHalfSizeY)
+{
+	CvMat* pRotationMat = cvCreateMat(2,2,CV_32F);
+	pRotationMat->data.fl[0] = cos(orientation);
+	pRotationMat->data.fl[1] = sin(orientation);
+	pRotationMat->data.fl[2] = -sin(orientation);
+	pRotationMat->data.fl[3] = cos(orientation);
 	
-		i = 0; j = 1;
-		float halfSizeY = pRotatedBoundingBox->data.fl[i*2+j];
-		for (i=1;i<4;i++)
-		{
-			float val = pRotatedBoundingBox->data.fl[i*2+j];
-			if (val > halfSizeY)
-				halfSizeY = val;
-		}		
-		
-		m_halfSizeX = halfSizeX;
-		m_halfSizeY = halfSizeY;
-
-		cvReleaseMat(&pRotatedBoundingBox);
-		cvReleaseMat(&pRotationMatTP);
-		cvReleaseMat(&pBoundingBox);
-		cvReleaseMat(&pBoundingBox);
-		cvReleaseMat(&pRotationMat);
-    }
-    return 0;
+
+	float unrotatedHalfSizeX = ceil(cutOff * sqrt(sx));
+	float unrotatedHalfSizeY = ceil(cutOff * sqrt(sy));
+	
+	CvMat* pBoundingBox = cvCreateMat(4,2,CV_32F);
+	pBoundingBox->data.fl[0] = unrotatedHalfSizeX;
+	pBoundingBox->data.fl[1] = unrotatedHalfSizeY;
+	pBoundingBox->data.fl[2] = -unrotatedHalfSizeX;
+	pBoundingBox->data.fl[3] = unrotatedHalfSizeY;
+	pBoundingBox->data.fl[4] = unrotatedHalfSizeX;
+	pBoundingBox->data.fl[5] = -unrotatedHalfSizeY;
+	pBoundingBox->data.fl[6] = -unrotatedHalfSizeX;
+	pBoundingBox->data.fl[7] = -unrotatedHalfSizeY;
+	
+	CvMat* pRotatedBoundingBox = cvCreateMat(4,2,CV_32F);
+	CvMat* pRotationMatTP = cvCreateMat(2,2,CV_32F);
+	cvTranspose(pRotationMat, pRotationMatTP);
+	cvMatMul(pBoundingBox, pRotationMatTP, pRotatedBoundingBox);
+	
+	int i=0, j=0;
+	float halfSizeX = pRotatedBoundingBox->data.fl[i*2+j];
+	for (i=1;i<4;i++)
+	{
+		float val = pRotatedBoundingBox->data.fl[i*2+j];
+		if (val > halfSizeX)
+			halfSizeX = val;
+	}
+	
+
+	i = 0; j = 1;
+	float halfSizeY = pRotatedBoundingBox->data.fl[i*2+j];
+	for (i=1;i<4;i++)
+	{
+		float val = pRotatedBoundingBox->data.fl[i*2+j];
+		if (val > halfSizeY)
+			halfSizeY = val;
+	}		
+	
+	*pHalfSizeX = halfSizeX;
+	*pHalfSizeY = halfSizeY;
+
+	cvReleaseMat(&pRotatedBoundingBox);
+	cvReleaseMat(&pRotationMatTP);
+	cvReleaseMat(&pBoundingBox);
+	cvReleaseMat(&pBoundingBox);
+	cvReleaseMat(&pRotationMat);
 }
 
 
@@ -236,6 +299,11 @@ void CvGabor::CreateKernel()
 		
 		Imag = pImgMat;
 		
+		// Kernels in the layout of the (untransposed) image, for ApplyMagnitude()
+		RealT = cvCreateMat(sizeX,sizeY,CV_32F);
+		ImagT = cvCreateMat(sizeX,sizeY,CV_32F);
+		cvTranspose(Real, RealT);
+		cvTranspose(Imag, ImagT);
 		
 		bKernel = TRUE;
 		
@@ -597,3 +665,258 @@ void CvGabor::Apply(IplImage *src, IplImage *dst, int Type)
     cvReleaseMat(&rmat);
     cvReleaseMat(&mat);
 }
+
+
+
+/*!
+    \fn CvGabor::get_transposed_matrix(int Type)
+Get the transposed kernel, which is the kernel in the layout of the image
+
+Parameters:
+    	Type		The type of kernel, CV_GABOR_REAL or CV_GABOR_IMAG
+
+Returns:
+    	Pointer to matrix structure, or NULL on failure.
+ */
+CvMat* CvGabor::get_transposed_matrix(int Type)
+{
+    if (!IsKernelCreate()) {perror("Error: the gabor kernel has not been created!\n"); return NULL;}
+    switch (Type)
+    {
+      case CV_GABOR_REAL:
+        return RealT;
+      case CV_GABOR_IMAG:
+        return ImagT;
+      default:
+        return NULL;
+    }
+}
+
+
+/*!
+    \fn CvGabor::GetAnchor()
+The anchor of the transposed kernel.
+Apply() filters the transposed image with anchor (m_sizeY/2, m_sizeX/2), 
+which is (m_sizeX/2, m_sizeY/2) in the layout of the image.
+ */
+CvPoint CvGabor::GetAnchor()
+{
+    return cvPoint(m_sizeX/2, m_sizeY/2);
+}
+
+
+/*
+Write sqrt(re^2 + im^2) of each pixel to pDst[(y*width+x)*nDstStride].
+The magnitude of each row is first computed (vectorized) in place of the real response.
+ */
+static void MagnitudeToColumn(CvMat *pRe, CvMat *pIm, float *pDst, int nDstStride)
+{
+    int nWidth = pRe->cols;
+    for (int i = 0; i < pRe->rows; i++)
+    {
+        float *pReRow = (float*)(pRe->data.ptr + i*pRe->step);
+        const float *pImRow = (const float*)(pIm->data.ptr + i*pIm->step);
+        int j = 0;
+#ifdef CV_GABOR_SSE
+        for (; j <= nWidth - 4; j += 4)
+        {
+            __m128 re = _mm_loadu_ps(pReRow + j);
+            __m128 im = _mm_loadu_ps(pImRow + j);
+            re = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+            _mm_storeu_ps(pReRow + j, re);
+        }
+#endif
+        for (; j < nWidth; j++)
+            pReRow[j] = sqrt(pReRow[j]*pReRow[j] + pImRow[j]*pImRow[j]);
+
+        float *pOut = pDst + (long)i*nWidth*nDstStride;
+        for (j = 0; j < nWidth; j++, pOut += nDstStride)
+            *pOut = pReRow[j];
+    }
+}
+
+
+/*!
+    \fn CvGabor::ApplyMagnitude(IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm)
+Magnitude response of the filter, without transposing the image
+
+Parameters:
+	src		32F single channel source image
+	pDst		output, the response of pixel (x,y) is written to pDst[(y*width+x)*nDstStride]
+	nDstStride	distance (in floats) between the outputs of consecutive pixels
+	pRe, pIm	32F scratch matrices, the size of src (owned by the caller, so they can be reused)
+
+Returns:
+	None
+
+Gives the same response as Apply(src, dst, CV_GABOR_MAG) with a 32F dst.
+ */
+void CvGabor::ApplyMagnitude(IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm)
+{
+    CvPoint anchor = GetAnchor();
+    cvFilter2D(src, pRe, RealT, anchor);
+    cvFilter2D(src, pIm, ImagT, anchor);
+
+    MagnitudeToColumn(pRe, pIm, pDst, nDstStride);
+}
+
+
+/*!
+    \fn CvGaborSeparable::Release()
+ */
+void CvGaborSeparable::Release()
+{
+    for (int k = 0; k < m_nRank; k++)
+    {
+        cvReleaseMat(&RealCols[k]);
+        cvReleaseMat(&RealRows[k]);
+        cvReleaseMat(&ImagCols[k]);
+        cvReleaseMat(&ImagRows[k]);
+    }
+    m_nRank = 0;
+}
+
+
+/*!
+    \fn CvGabor::DecomposeKernel(CvMat *kernel, int nRank, CvMat *cols[], CvMat *rows[])
+Approximate kernel by the nRank largest terms of its SVD, each term is a 
+(column vector) x (row vector) pair.
+
+Parameters:
+	kernel		the kernel to decompose
+	nRank		the number of terms
+	cols, rows	[out] the nRank column and row vectors (the caller releases them)
+
+Returns:
+	The error of the approximation, relative to the kernel (Frobenius norm)
+ */
+double CvGabor::DecomposeKernel(CvMat *kernel, int nRank, CvMat *cols[], CvMat *rows[])
+{
+    int m = kernel->rows;
+    int n = kernel->cols;
+    int nMin = MIN(m, n);
+
+    CvMat *A = cvCreateMat(m, n, CV_64FC1);
+    CvMat *W = cvCreateMat(nMin, 1, CV_64FC1);
+    CvMat *U = cvCreateMat(m, nMin, CV_64FC1);
+    CvMat *V = cvCreateMat(n, nMin, CV_64FC1);
+    cvConvert(kernel, A);
+    cvSVD(A, W, U, V, CV_SVD_MODIFY_A);
+
+    double total = 0, kept = 0;
+    for (int k = 0; k < nMin; k++)
+    {
+        total += W->data.db[k]*W->data.db[k];
+        if (k < nRank)
+            kept += W->data.db[k]*W->data.db[k];
+    }
+
+    // Split each singular value evenly between the two vectors
+    for (int k = 0; k < nRank; k++)
+    {
+        double s = (k < nMin) ? sqrt(W->data.db[k]) : 0;
+        cols[k] = cvCreateMat(m, 1, CV_32FC1);
+        rows[k] = cvCreateMat(1, n, CV_32FC1);
+        for (int i = 0; i < m; i++)
+            cols[k]->data.fl[i] = (k < nMin) ? (float)(s * U->data.db[i*nMin + k]) : 0;
+        for (int j = 0; j < n; j++)
+            rows[k]->data.fl[j] = (k < nMin) ? (float)(s * V->data.db[j*nMin + k]) : 0;
+    }
+
+    cvReleaseMat(&V);
+    cvReleaseMat(&U);
+    cvReleaseMat(&W);
+    cvReleaseMat(&A);
+
+    return (total > 0) ? sqrt(MAX(total - kept, 0.0) / total) : 0;
+}
+
+
+/*!
+    \fn CvGabor::CreateSeparable(int nMaxRank, double dMaxError, CvGaborSeparable *pSeparable)
+Create a separable (low rank) approximation of the kernels.
+0 and 90 degrees kernels are exactly separable, the others are well approximated with 2-3 terms.
+The gabor itself is only read, so shared gabors can be decomposed by each of their users.
+
+Parameters:
+	nMaxRank	the maximal number of separable terms (up to CV_GABOR_MAX_RANK)
+	dMaxError	stop adding terms once the error, relative to the kernel (Frobenius norm), is below it
+	pSeparable	[out] the separable kernels
+
+Returns:
+	The chosen rank
+ */
+int CvGabor::CreateSeparable(int nMaxRank, double dMaxError, CvGaborSeparable *pSeparable)
+{
+    pSeparable->Release();
+    if (!IsKernelCreate()) {perror("Error: the gabor kernel has not been created!\n"); return 0;}
+
+    nMaxRank = MAX(1, MIN(nMaxRank, CV_GABOR_MAX_RANK));
+
+    int nRank;
+    for (nRank = 1; nRank <= nMaxRank; nRank++)
+    {
+        CvMat *realCols[CV_GABOR_MAX_RANK], *realRows[CV_GABOR_MAX_RANK];
+        CvMat *imagCols[CV_GABOR_MAX_RANK], *imagRows[CV_GABOR_MAX_RANK];
+        double realError = DecomposeKernel(RealT, nRank, realCols, realRows);
+        double imagError = DecomposeKernel(ImagT, nRank, imagCols, imagRows);
+
+        for (int k = 0; k < nRank; k++)
+        {
+            pSeparable->RealCols[k] = realCols[k];
+            pSeparable->RealRows[k] = realRows[k];
+            pSeparable->ImagCols[k] = imagCols[k];
+            pSeparable->ImagRows[k] = imagRows[k];
+        }
+        pSeparable->m_nRank = nRank;
+        pSeparable->m_dError = MAX(realError, imagError);
+
+        if (pSeparable->m_dError <= dMaxError || nRank == nMaxRank)
+            break;
+
+        pSeparable->Release();
+    }
+
+    return pSeparable->m_nRank;
+}
+
+
+/*!
+    \fn CvGabor::ApplyMagnitudeSeparable(const CvGaborSeparable *pSeparable, IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm, CvMat *pTmp)
+Same as ApplyMagnitude(), with the separable kernels made by CreateSeparable().
+Each term costs a vertical and a horizontal 1D pass, O(k) instead of O(k^2) per pixel.
+
+Parameters:
+	pSeparable	the separable kernels of this gabor
+	pTmp		an additional 32F scratch matrix the size of src
+ */
+void CvGabor::ApplyMagnitudeSeparable(const CvGaborSeparable *pSeparable, IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm, CvMat *pTmp)
+{
+    if (pSeparable->m_nRank == 0) {perror("Error: the separable kernels have not been created!\n"); return;}
+
+    CvPoint anchor = GetAnchor();
+    CvPoint colAnchor = cvPoint(0, anchor.y);
+    CvPoint rowAnchor = cvPoint(anchor.x, 0);
+
+    for (int k = 0; k < pSeparable->m_nRank; k++)
+    {
+        if (k == 0)
+        {
+            cvFilter2D(src, pTmp, pSeparable->RealCols[k], colAnchor);
+            cvFilter2D(pTmp, pRe, pSeparable->RealRows[k], rowAnchor);
+            cvFilter2D(src, pTmp, pSeparable->ImagCols[k], colAnchor);
+            cvFilter2D(pTmp, pIm, pSeparable->ImagRows[k], rowAnchor);
+        }
+        else
+        {
+            cvFilter2D(src, pTmp, pSeparable->RealCols[k], colAnchor);
+            cvFilter2D(pTmp, pTmp, pSeparable->RealRows[k], rowAnchor);
+            cvAdd(pRe, pTmp, pRe);
+            cvFilter2D(src, pTmp, pSeparable->ImagCols[k], colAnchor);
+            cvFilter2D(pTmp, pTmp, pSeparable->ImagRows[k], rowAnchor);
+            cvAdd(pIm, pTmp, pIm);
+        }
+    }
+
+    MagnitudeToColumn(pRe, pIm, pDst, nDstStride);
+}
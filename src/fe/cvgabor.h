@@ -35,6 +35,35 @@
 #define CV_GABOR_IMAG 2
 #define CV_GABOR_MAG  3
 #define CV_GABOR_PHASE 4
+#define CV_GABOR_MAX_RANK 4
+
+/**
+ * Rank-k approximation of the RealT/ImagT kernels of a CvGabor: a sum of 
+ * (column vector) x (row vector) kernels, made by CvGabor::CreateSeparable().
+ * Kept apart from the gabor, so the shared gabors are never modified
+ **/
+class CvGaborSeparable
+{
+public:
+    CvGaborSeparable():m_nRank(0),m_dError(0) {}
+    ~CvGaborSeparable()                 { Release(); }
+
+    void Release();
+
+    int GetRank() const                 { return m_nRank; }
+
+    /**
+     * The error relative to the full kernels (Frobenius norm)
+     **/
+    double GetError() const             { return m_dError; }
+
+    int m_nRank;
+    double m_dError;
+    CvMat *RealCols[CV_GABOR_MAX_RANK];
+    CvMat *RealRows[CV_GABOR_MAX_RANK];
+    CvMat *ImagCols[CV_GABOR_MAX_RANK];
+    CvMat *ImagRows[CV_GABOR_MAX_RANK];
+};
 
 /**
 @author Mian Zhou
@@ -46,8 +75,10 @@ public:
     ~CvGabor();
 
      CvGabor(float orientation, float freq, float sx, float sy);
+     CvGabor(float orientation, float freq, float sx, float sy, CvMat *pReal, CvMat *pImag);
     bool IsInit();
     long CalcKernelSize();
+    static CvSize CalcKernelSize(float orientation, float sx, float sy);
     IplImage* get_image(int Type);
     bool IsKernelCreate();
     long GetKernelSize();
@@ -56,6 +87,11 @@ public:
     CvMat* get_matrix(int Type);
     void show(int Type);
     void Apply(IplImage *src, IplImage *dst, int Type);
+    void ApplyMagnitude(IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm);
+    int CreateSeparable(int nMaxRank, double dMaxError, CvGaborSeparable *pSeparable);
+    void ApplyMagnitudeSeparable(const CvGaborSeparable *pSeparable, IplImage *src, float *pDst, int nDstStride, CvMat *pRe, CvMat *pIm, CvMat *pTmp);
+    CvMat* get_transposed_matrix(int Type);
+    CvPoint GetAnchor();
 
 protected:
 	float m_orientation;
@@ -75,8 +111,12 @@ protected:
     long Width;
     CvMat *Imag;
     CvMat *Real;
+    CvMat *ImagT;
+    CvMat *RealT;
 private:
     void CreateKernel();
+    static void CalcHalfSize(float orientation, float sx, float sy, float cutOff, float *pHalfSizeX, float *pHalfSizeY);
+    double DecomposeKernel(CvMat *kernel, int nRank, CvMat *cols[], CvMat *rows[]);
 
 };
 
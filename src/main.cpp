@@ -2,9 +2,14 @@
 #include "Textonator.h"
 #include "Synthesizer.h"
 #include "RealitySynthesizer.h"
+#include "Benchmark.h"
+#include "fe/GaborKernelCache.h"
 
 #include <shlwapi.h>
 #include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define REAL_SYNTH
 
@@ -37,7 +42,7 @@ void showTextons(vector<Cluster>& clusterList, char *strOutPath)
 
 int main(int argc, char ** argv)
 {
-	IplImage * pInputImage;
+	IplImage * pInputImage = NULL;
 	vector<Cluster> clusterList;
 	int nNum = 0;
 	int nCurCluster = 0;
@@ -46,7 +51,18 @@ int main(int argc, char ** argv)
 	  std::cout << "Usage: texturesynth -i image_file_path -o [output_path]\n" << 
 		  "-w [new_width] -h [new_height] -cn [cluster_number]\n "<<
 		  "-mts [minimum_texton_size] -bpx [background_pixel_x] -bpy [background_pixel_y]\n" <<
-		  "-ws [window_size] -md [maximum_iterations_difference]" << std::endl;
+		  "-ws [window_size] -md [maximum_iterations_difference]\n" <<
+		  "-gabor [spatial|fft|octave|separable] -gaborrank [separable_rank]\n" <<
+		  "-gaborerror [separable_kernel_error] -gaborbank [kernels_file] -histradius [histogram_radius]\n" <<
+		  "-pcarate [pca_sample_rate] -pcaseed [pca_sample_seed] -pcadiag [0|1]\n" <<
+		  "-memlimit [feature_extraction_MB] -storage [float|half|byte] -cache [features_directory]\n" <<
+		  "-kmeans [cv|lloyd|hamerly|minibatch] -kmeansinit [random|plusplus]\n" <<
+		  "-batchsize [minibatch_rows] -batchiter [minibatch_iterations] -superpixel [superpixel_size]\n" <<
+		  "-sweep [min_clusters:max_clusters] -labeling [flood|unionfind]\n" <<
+		  "-edges [cluster|shared] (unionfind is a single pass only with shared edges,\n" <<
+		  "        cluster edges still run Canny once per cluster)\n" <<
+		  "-threads [threads_number] "<<
+		  "-bench [benchmark_name]" << std::endl;
 	  return (-1);
 	}
 
@@ -58,6 +74,12 @@ int main(int argc, char ** argv)
 	int nMaxDiff = 5000;
 	char *strOutPath = "";
 	char *strInputImage = "";
+	char *strBenchmark = "";
+	char *strGaborBank = "";
+	char *strFeatureCache = "";
+	SFeatureParams featureParams;
+	SClusterParams clusterParams;
+	STextonParams textonParams;
 	CvScalar backgroundPixel = cvScalarAll(UNDEFINED);
 
 	if (argc == 2) {
@@ -105,6 +127,133 @@ int main(int argc, char ** argv)
 			else if (!strcmp(argv[i], "-md")){
 				nMaxDiff = atoi(argv[i+1]);
 			}
+			else if (!strcmp(argv[i], "-gabor")){
+				if (!strcmp(argv[i+1], "spatial"))
+					featureParams.nGaborMode = GABOR_MODE_SPATIAL;
+				else if (!strcmp(argv[i+1], "fft"))
+					featureParams.nGaborMode = GABOR_MODE_FFT;
+				else if (!strcmp(argv[i+1], "octave"))
+					featureParams.nGaborMode = GABOR_MODE_OCTAVE;
+				else if (!strcmp(argv[i+1], "separable"))
+					featureParams.nGaborMode = GABOR_MODE_SEPARABLE;
+				else {
+					std::cout << "Unknown Gabor mode ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-gaborrank")){
+				featureParams.nGaborRank = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-gaborerror")){
+				featureParams.dGaborMaxError = atof(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-histradius")){
+				featureParams.nHistogramRadius = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-pcarate")){
+				featureParams.dPcaSampleRate = atof(argv[i+1]);
+				if (featureParams.dPcaSampleRate <= 0 || featureParams.dPcaSampleRate > 1) {
+					std::cout << "The PCA sample rate must be in (0,1]. Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-pcaseed")){
+				featureParams.nPcaSeed = (unsigned int)atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-pcadiag")){
+				featureParams.fPcaDiagnostics = (atoi(argv[i+1]) != 0);
+			}
+			else if (!strcmp(argv[i], "-memlimit")){
+				featureParams.nMemoryLimit = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-storage")){
+				if (!strcmp(argv[i+1], "float"))
+					clusterParams.nStorage = FEATURE_STORAGE_FLOAT;
+				else if (!strcmp(argv[i+1], "half"))
+					clusterParams.nStorage = FEATURE_STORAGE_HALF;
+				else if (!strcmp(argv[i+1], "byte"))
+					clusterParams.nStorage = FEATURE_STORAGE_BYTE;
+				else {
+					std::cout << "Unknown feature storage ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-kmeans")){
+				if (!strcmp(argv[i+1], "cv"))
+					clusterParams.nAlgorithm = KMEANS_CV;
+				else if (!strcmp(argv[i+1], "lloyd"))
+					clusterParams.nAlgorithm = KMEANS_LLOYD;
+				else if (!strcmp(argv[i+1], "hamerly"))
+					clusterParams.nAlgorithm = KMEANS_HAMERLY;
+				else if (!strcmp(argv[i+1], "minibatch"))
+					clusterParams.nAlgorithm = KMEANS_MINIBATCH;
+				else {
+					std::cout << "Unknown k-means algorithm ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-kmeansinit")){
+				if (!strcmp(argv[i+1], "random"))
+					clusterParams.nSeeding = KMEANS_SEED_RANDOM;
+				else if (!strcmp(argv[i+1], "plusplus"))
+					clusterParams.nSeeding = KMEANS_SEED_PLUSPLUS;
+				else {
+					std::cout << "Unknown k-means seeding ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-batchsize")){
+				clusterParams.nBatchSize = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-batchiter")){
+				clusterParams.nBatchIterations = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-superpixel")){
+				clusterParams.nSuperpixelSize = atoi(argv[i+1]);
+			}
+			else if (!strcmp(argv[i], "-sweep")){
+				if (sscanf_s(argv[i+1], "%d:%d", &clusterParams.nSweepMin, &clusterParams.nSweepMax) != 2 ||
+					clusterParams.nSweepMin < 1 || clusterParams.nSweepMax < clusterParams.nSweepMin) {
+					std::cout << "Bad cluster count range ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-labeling")){
+				if (!strcmp(argv[i+1], "flood"))
+					textonParams.nLabeling = TEXTON_LABELING_FLOOD;
+				else if (!strcmp(argv[i+1], "unionfind"))
+					textonParams.nLabeling = TEXTON_LABELING_UNIONFIND;
+				else {
+					std::cout << "Unknown texton labeling ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-edges")){
+				if (!strcmp(argv[i+1], "cluster"))
+					textonParams.nEdges = TEXTON_EDGES_CLUSTER;
+				else if (!strcmp(argv[i+1], "shared"))
+					textonParams.nEdges = TEXTON_EDGES_SHARED;
+				else {
+					std::cout << "Unknown texton edges ("<< argv[i+1] <<"). Aborting..." << std::endl;
+					return (-1);
+				}
+			}
+			else if (!strcmp(argv[i], "-cache")){
+				strFeatureCache = argv[i+1];
+			}
+			else if (!strcmp(argv[i], "-gaborbank")){
+				strGaborBank = argv[i+1];
+			}
+			else if (!strcmp(argv[i], "-threads")){
+#ifdef _OPENMP
+				omp_set_num_threads(atoi(argv[i+1]));
+#else
+				std::cout << "Built without OpenMP, -threads is ignored." << std::endl;
+#endif
+			}
+			else if (!strcmp(argv[i], "-bench")){
+				strBenchmark = argv[i+1];
+			}
 			else {
 				std::cout << "Unknown argument ("<< argv[i] <<"). Aborting..." << std::endl;
 				return (-1);
@@ -112,6 +261,25 @@ int main(int argc, char ** argv)
 		}
 	}
 
+	// Skip the kernel generation if the Gabor bank was saved by a previous run
+	if (strcmp(strGaborBank, "") && CGaborKernelCache::Load(strGaborBank))
+		std::cout << "Gabor kernels were loaded from " << strGaborBank << std::endl;
+
+	if (strcmp(strBenchmark, "")) {
+		if (!Benchmark::run(strBenchmark, pInputImage, nClusters)) {
+			std::cout << "Unknown benchmark ("<< strBenchmark <<"). Aborting..." << std::endl;
+			return (-1);
+		}
+		if (pInputImage != NULL)
+			cvReleaseImage(&pInputImage);
+		return (0);
+	}
+
+	if (pInputImage == NULL) {
+		std::cout << "No input image was given. Aborting..." << std::endl;
+		return (-1);
+	}
+
 	if (nNewWidth == 0){
 		//std::cout << "New width argument was not given. Resetting to default width..." << std::endl;
 		nNewWidth = pInputImage->width;
@@ -131,7 +299,13 @@ int main(int argc, char ** argv)
 	time_t t1 = time(NULL);
 	DWORD time1 = GetTickCount();
 	Textonator * textonator = new Textonator(pInputImage, nClusters, nMinTextonSize, backgroundPixel);
+	textonator->setFeatureParams(featureParams);
+	textonator->setClusterParams(clusterParams);
+	textonator->setTextonParams(textonParams);
+	if (strcmp(strFeatureCache, ""))
+		textonator->setFeatureCache(strFeatureCache);
 	textonator->textonize(clusterList);
+	nClusters = textonator->getClusterNum();
 	DWORD time2 = GetTickCount();
 	time_t t2 = time(NULL);
 	printf("Textonator diff time = %ld, %d seconds\n\n", time2 - time1, t2 - t1);
@@ -179,5 +353,12 @@ int main(int argc, char ** argv)
 	cvReleaseImage(&pInputImage);
 
 	delete textonator;
+
+	if (strcmp(strGaborBank, "") && CGaborKernelCache::IsDirty()) {
+		if (!CGaborKernelCache::Save(strGaborBank))
+			std::cout << "The Gabor kernels could not be saved to " << strGaborBank << std::endl;
+	}
+	CGaborKernelCache::Clear();
+
 	return (0);
 }